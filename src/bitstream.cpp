@@ -0,0 +1,65 @@
+#include "bitstream.h"
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include "logging.h"
+
+using namespace std;
+
+namespace EventSim {
+
+  std::vector<std::pair<unsigned int, unsigned int> >
+  loadBitStream(const std::string& fileName) {
+    std::ifstream t(fileName);
+    std::string configBits((std::istreambuf_iterator<char>(t)),
+                           std::istreambuf_iterator<char>());
+
+    std::vector<std::string> strings;
+
+    std::string::size_type pos = 0;
+    std::string::size_type prev = 0;
+    char delimiter = '\n';
+    string str = configBits;
+    while ((pos = str.find(delimiter, prev)) != std::string::npos) {
+      strings.push_back(str.substr(prev, pos - prev));
+      prev = pos + 1;
+    }
+
+    // To get the last substring (or only, if delimiter is not found)
+    strings.push_back(str.substr(prev));
+
+    vector<pair<unsigned int, unsigned int> > configValues;
+    for (int i = 0; i < (int) strings.size(); i++) {
+
+      // Files usually end with a newline
+      if (strings[i].size() < 9) {
+        continue;
+      }
+
+      if (logEnabled(LOG_LEVEL_DEBUG)) {
+        logMessage(LOG_LEVEL_DEBUG, "Config line " + strings[i]);
+      }
+
+      string addrStr = strings[i].substr(0, 8);
+
+      unsigned int configAddr;
+      std::stringstream ss;
+      ss << std::hex << addrStr;
+      ss >> configAddr;
+
+      string dataStr = strings[i].substr(9, 18);
+
+      unsigned int configData;
+      std::stringstream ss2;
+      ss2 << std::hex << dataStr;
+      ss2 >> configData;
+
+      configValues.push_back({configAddr, configData});
+    }
+
+    return configValues;
+  }
+
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace EventSim {
+
+  // Reads a CGRA bitstream (.bsa) file. Each line holds a 32 bit config
+  // address and 32 bit config data word in hex, separated by a space.
+  std::vector<std::pair<unsigned int, unsigned int> >
+  loadBitStream(const std::string& fileName);
+
+}
@@ -0,0 +1,40 @@
+#include "logging.h"
+
+#include <iostream>
+
+using namespace std;
+
+namespace EventSim {
+
+  static void defaultLogSink(const LogLevel level, const std::string& msg) {
+    cerr << msg << endl;
+  }
+
+  static LogLevel currentLogLevel = LOG_LEVEL_SILENT;
+  static LogSink currentLogSink = defaultLogSink;
+
+  void setLogLevel(const LogLevel level) {
+    currentLogLevel = level;
+  }
+
+  LogLevel getLogLevel() {
+    return currentLogLevel;
+  }
+
+  void setLogSink(const LogSink& sink) {
+    currentLogSink = sink;
+  }
+
+  void resetLogSink() {
+    currentLogSink = defaultLogSink;
+  }
+
+  void logMessage(const LogLevel level, const std::string& msg) {
+    if (!logEnabled(level)) {
+      return;
+    }
+
+    currentLogSink(level, msg);
+  }
+
+}
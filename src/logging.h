@@ -0,0 +1,34 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+namespace EventSim {
+
+  enum LogLevel {
+    LOG_LEVEL_SILENT,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+  };
+
+  // A sink receives every message at or below the current log level. The
+  // default sink writes to std::cerr.
+  typedef std::function<void(const LogLevel, const std::string&)> LogSink;
+
+  void setLogLevel(const LogLevel level);
+  LogLevel getLogLevel();
+
+  void setLogSink(const LogSink& sink);
+  void resetLogSink();
+
+  // Callers should check logEnabled before building a message so that
+  // silent runs (the default) never pay for string formatting.
+  static inline bool logEnabled(const LogLevel level) {
+    return (level != LOG_LEVEL_SILENT) && (level <= getLogLevel());
+  }
+
+  void logMessage(const LogLevel level, const std::string& msg);
+
+}
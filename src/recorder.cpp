@@ -0,0 +1,297 @@
+#include "recorder.h"
+
+#include <cstddef>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace EventSim {
+
+  static const char RECORDER_MAGIC[4] = {'E', 'S', 'O', 'T'};
+  static const uint32_t RECORDER_VERSION = 2;
+
+  // Followed by numSignals (name length, name, width) entries
+  struct RecorderHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t numCycles;
+    uint32_t numSignals;
+    uint32_t blockCycles;
+  };
+
+  OutputRecorder::OutputRecorder(EventSimulator& sim,
+                                 const std::vector<std::string>& names_,
+                                 const std::string& path,
+                                 const int blockCycles_) :
+    names(names_),
+    blockCycles(blockCycles_),
+    numBuffered(0),
+    numCycles(0),
+    valueColumns(names_.size() * blockCycles_),
+    unknownColumns(names_.size() * blockCycles_),
+    out(path, ios::binary | ios::trunc) {
+
+    assert(blockCycles > 0);
+
+    if (!out.is_open()) {
+      if (logEnabled(LOG_LEVEL_ERROR)) {
+        logMessage(LOG_LEVEL_ERROR, "ERROR: Could not open output file " + path);
+      }
+      return;
+    }
+
+    for (auto& name : names) {
+      const WireValue* value = sim.findValueHandle(name);
+      if ((value == nullptr) || (bitWidth(*value) > 64)) {
+        if (logEnabled(LOG_LEVEL_ERROR)) {
+          logMessage(LOG_LEVEL_ERROR, value == nullptr ?
+                     "ERROR: Cannot record unknown signal " + name :
+                     "ERROR: Cannot record " + name + ", wider than 64 bits");
+        }
+        values.clear();
+        out.close();
+        return;
+      }
+      values.push_back(value);
+    }
+
+    RecorderHeader header;
+    memcpy(header.magic, RECORDER_MAGIC, sizeof(RECORDER_MAGIC));
+    header.version = RECORDER_VERSION;
+    header.numCycles = 0;
+    header.numSignals = names.size();
+    header.blockCycles = blockCycles;
+
+    numCyclesPos = offsetof(RecorderHeader, numCycles);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    uint64_t written = sizeof(header);
+    for (int i = 0; i < (int) names.size(); i++) {
+      const string& name = names[i];
+      uint32_t nameLength = name.size();
+      uint32_t width = bitWidth(*values[i]);
+
+      out.write(reinterpret_cast<const char*>(&nameLength), sizeof(nameLength));
+      out.write(name.c_str(), nameLength);
+      out.write(reinterpret_cast<const char*>(&width), sizeof(width));
+      written += sizeof(nameLength) + nameLength + sizeof(width);
+    }
+
+    const char padding[8] = {0};
+    out.write(padding, (8 - (written % 8)) % 8);
+  }
+
+  void OutputRecorder::flush() {
+    if ((numBuffered == 0) || !out.is_open()) {
+      numBuffered = 0;
+      return;
+    }
+
+    uint64_t blockSize = numBuffered;
+    out.write(reinterpret_cast<const char*>(&blockSize), sizeof(blockSize));
+
+    for (int i = 0; i < (int) values.size(); i++) {
+      out.write(reinterpret_cast<const char*>(&valueColumns[i * blockCycles]),
+                numBuffered * sizeof(uint64_t));
+      out.write(reinterpret_cast<const char*>(&unknownColumns[i * blockCycles]),
+                numBuffered * sizeof(uint64_t));
+    }
+
+    numBuffered = 0;
+  }
+
+  void OutputRecorder::close() {
+    if (!out.is_open()) {
+      return;
+    }
+
+    flush();
+
+    out.seekp(numCyclesPos);
+    out.write(reinterpret_cast<const char*>(&numCycles), sizeof(numCycles));
+    out.close();
+  }
+
+  TraceChecker::TraceChecker(EventSimulator& sim, const std::string& path) :
+    data(nullptr),
+    size(0),
+    numCycles(0),
+    cycle(0),
+    block(nullptr),
+    blockSize(0),
+    blockCycle(0),
+    end(nullptr) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      if (logEnabled(LOG_LEVEL_ERROR)) {
+        logMessage(LOG_LEVEL_ERROR, "ERROR: Could not open trace " + path);
+      }
+      return;
+    }
+
+    struct stat info;
+    if ((fstat(fd, &info) != 0) ||
+        (info.st_size < (off_t) sizeof(RecorderHeader))) {
+      close(fd);
+      return;
+    }
+
+    size_t fileSize = info.st_size;
+    void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+      return;
+    }
+
+    const char* bytes = static_cast<const char*>(mapped);
+    const RecorderHeader* header = static_cast<const RecorderHeader*>(mapped);
+
+    bool valid =
+      (memcmp(header->magic, RECORDER_MAGIC, sizeof(RECORDER_MAGIC)) == 0) &&
+      (header->version == RECORDER_VERSION);
+
+    size_t pos = sizeof(RecorderHeader);
+    for (uint32_t i = 0; valid && (i < header->numSignals); i++) {
+      uint32_t nameLength = 0;
+      uint32_t width = 0;
+
+      valid = pos + sizeof(nameLength) <= fileSize;
+      if (!valid) {
+        break;
+      }
+      memcpy(&nameLength, bytes + pos, sizeof(nameLength));
+      pos += sizeof(nameLength);
+
+      valid = pos + nameLength + sizeof(width) <= fileSize;
+      if (!valid) {
+        break;
+      }
+      string name(bytes + pos, nameLength);
+      pos += nameLength;
+      memcpy(&width, bytes + pos, sizeof(width));
+      pos += sizeof(width);
+
+      const WireValue* value = sim.findValueHandle(name);
+      if (value == nullptr) {
+        if (logEnabled(LOG_LEVEL_ERROR)) {
+          logMessage(LOG_LEVEL_ERROR, "ERROR: Unknown signal " + name +
+                     " in trace " + path);
+        }
+        munmap(mapped, fileSize);
+        names.clear();
+        widths.clear();
+        values.clear();
+        return;
+      }
+
+      valid = bitWidth(*value) == (int) width;
+      if (!valid) {
+        if (logEnabled(LOG_LEVEL_ERROR)) {
+          logMessage(LOG_LEVEL_ERROR, "ERROR: Width of " + name +
+                     " does not match trace " + path);
+        }
+        break;
+      }
+
+      names.push_back(name);
+      widths.push_back(width);
+      values.push_back(value);
+    }
+
+    pos += (8 - (pos % 8)) % 8;
+
+    if (!valid || (pos > fileSize)) {
+      if (logEnabled(LOG_LEVEL_ERROR)) {
+        logMessage(LOG_LEVEL_ERROR, "ERROR: Malformed trace " + path);
+      }
+      munmap(mapped, fileSize);
+      names.clear();
+      widths.clear();
+      values.clear();
+      return;
+    }
+
+    data = mapped;
+    size = fileSize;
+    numCycles = header->numCycles;
+    end = bytes + fileSize;
+
+    // An empty block ending where the first real block starts
+    block = reinterpret_cast<const uint64_t*>(bytes + pos);
+    blockSize = 0;
+    blockCycle = 0;
+  }
+
+  TraceChecker::~TraceChecker() {
+    if (data != nullptr) {
+      munmap(data, size);
+    }
+  }
+
+  // Moves to the block after the current one
+  bool TraceChecker::nextBlock() {
+    const uint64_t* next = block + 2 * values.size() * blockSize;
+    if (reinterpret_cast<const char*>(next + 1) > end) {
+      return false;
+    }
+
+    uint64_t nextSize = *next;
+    const uint64_t* columns = next + 1;
+    if ((nextSize == 0) ||
+        (reinterpret_cast<const char*>(columns + 2 * values.size() * nextSize) > end)) {
+      return false;
+    }
+
+    block = columns;
+    blockSize = nextSize;
+    blockCycle = 0;
+    return true;
+  }
+
+  static std::string formatWord(const uint64_t word,
+                                const uint64_t unknown,
+                                const int width) {
+    stringstream ss;
+    ss << width << "'";
+    if (unknown == 0) {
+      ss << "h" << std::hex << word;
+      return ss.str();
+    }
+
+    ss << "b";
+    for (int i = width - 1; i >= 0; i--) {
+      if ((unknown >> i) & 1) {
+        ss << "x";
+      } else {
+        ss << ((word >> i) & 1);
+      }
+    }
+    return ss.str();
+  }
+
+  std::string TraceChecker::report() const {
+    if (mismatches.size() == 0) {
+      return atEnd() ? "Reached the end of the trace at cycle " + to_string(cycle) : "";
+    }
+
+    string msg = "Mismatch at cycle " + to_string(cycle) + ":";
+    for (auto& mismatch : mismatches) {
+      msg += "\n  " + mismatch.name +
+        " expected " + formatWord(mismatch.expected,
+                                  mismatch.expectedUnknown,
+                                  mismatch.width) +
+        " got " + formatWord(mismatch.actual,
+                             mismatch.actualUnknown,
+                             mismatch.width);
+    }
+    return msg;
+  }
+
+}
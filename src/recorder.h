@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "simulator.h"
+
+namespace EventSim {
+
+  // Samples a fixed set of signals, each at most 64 bits wide, once per
+  // call to sample and writes them to a binary file. Samples are buffered
+  // in columns of blockCycles values per signal and written a block at a
+  // time:
+  //
+  //   header | signal names and widths | padding to 8 bytes | blocks
+  //
+  // Each block is a word holding its number of cycles n, then for every
+  // signal n value words followed by n words marking x and z bits.
+  class OutputRecorder {
+    std::vector<std::string> names;
+    std::vector<const WireValue*> values;
+
+    int blockCycles;
+    int numBuffered;
+    uint64_t numCycles;
+
+    // Column i holds blockCycles words starting at i * blockCycles
+    std::vector<uint64_t> valueColumns;
+    std::vector<uint64_t> unknownColumns;
+
+    std::ofstream out;
+    std::streampos numCyclesPos;
+
+  public:
+
+    OutputRecorder(EventSimulator& sim,
+                   const std::vector<std::string>& names_,
+                   const std::string& path,
+                   const int blockCycles_ = 4096);
+
+    ~OutputRecorder() { close(); }
+
+    bool isOpen() const { return out.is_open(); }
+
+    uint64_t getNumCycles() const { return numCycles; }
+
+    // Records the current value of every signal as the next cycle. Call
+    // after each clock edge.
+    void sample() {
+      for (int i = 0; i < (int) values.size(); i++) {
+        int slot = i * blockCycles + numBuffered;
+        readWord(*values[i], valueColumns[slot], unknownColumns[slot]);
+      }
+
+      numBuffered++;
+      numCycles++;
+
+      if (numBuffered == blockCycles) {
+        flush();
+      }
+    }
+
+    // Writes buffered cycles as a block
+    void flush();
+
+    // Flushes and records the number of cycles in the header
+    void close();
+  };
+
+  // A signal whose value differs from a reference trace
+  struct TraceMismatch {
+    std::string name;
+    int width;
+    uint64_t expected;
+    uint64_t expectedUnknown;
+    uint64_t actual;
+    uint64_t actualUnknown;
+  };
+
+  // Compares signals to a reference trace in OutputRecorder's format,
+  // streaming through it one cycle per call to check. Every signal in the
+  // trace must exist in the simulator with the same width.
+  class TraceChecker {
+    void* data;
+    size_t size;
+
+    std::vector<std::string> names;
+    std::vector<int> widths;
+    std::vector<const WireValue*> values;
+
+    uint64_t numCycles;
+    uint64_t cycle;
+
+    // The block holding cycle, and the position of cycle within it
+    const uint64_t* block;
+    uint64_t blockSize;
+    uint64_t blockCycle;
+    const char* end;
+
+    std::vector<TraceMismatch> mismatches;
+
+    bool nextBlock();
+
+  public:
+
+    TraceChecker(EventSimulator& sim, const std::string& path);
+
+    ~TraceChecker();
+
+    bool isOpen() const { return data != nullptr; }
+
+    uint64_t getNumCycles() const { return numCycles; }
+
+    // The next cycle check compares
+    uint64_t getCycle() const { return cycle; }
+
+    bool atEnd() const { return cycle >= numCycles; }
+
+    // Compares the current value of every signal to the next cycle of the
+    // trace. Returns false, recording every differing signal, on a
+    // mismatch or if the trace has ended.
+    bool check() {
+      if (atEnd() || ((blockCycle == blockSize) && !nextBlock())) {
+        return false;
+      }
+
+      for (int i = 0; i < (int) values.size(); i++) {
+        uint64_t actual;
+        uint64_t actualUnknown;
+        readWord(*values[i], actual, actualUnknown);
+
+        uint64_t expected = block[2 * i * blockSize + blockCycle];
+        uint64_t expectedUnknown =
+          block[(2 * i + 1) * blockSize + blockCycle];
+
+        if ((actual != expected) || (actualUnknown != expectedUnknown)) {
+          mismatches.push_back({names[i], widths[i],
+                expected, expectedUnknown, actual, actualUnknown});
+        }
+      }
+
+      if (mismatches.size() > 0) {
+        return false;
+      }
+
+      blockCycle++;
+      cycle++;
+      return true;
+    }
+
+    const std::vector<TraceMismatch>& getMismatches() const {
+      return mismatches;
+    }
+
+    // Describes the mismatching cycle and each differing signal
+    std::string report() const;
+  };
+
+}
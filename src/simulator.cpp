@@ -1,5 +1,10 @@
 #include "simulator.h"
 
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <thread>
+
 using namespace CoreIR;
 using namespace std;
 
@@ -9,6 +14,10 @@ namespace EventSim {
                          const WireValue* const source) {
     assert(receiver->getType() == source->getType());
 
+    if (receiver == source) {
+      return;
+    }
+
     if (receiver->getType() == WIRE_VALUE_BIT) {
       BitValue* const receiverBV =
         static_cast<BitValue* const>(receiver);
@@ -45,11 +54,15 @@ namespace EventSim {
       const RecordValue* const sourceRecord =
         static_cast<const RecordValue* const>(source);
 
-      assert(receiverRecord->getFields().size() == sourceRecord->getFields().size());
+      auto& receiverFields = receiverRecord->getFields();
+      auto& sourceFields = sourceRecord->getFields();
 
-      for (auto field : receiverRecord->getFields()) {
-        receiverRecord->setFieldValue(field.first,
-                                      sourceRecord->getFieldValue(field.first));
+      assert(receiverFields.size() == sourceFields.size());
+
+      // Copy in place rather than rebinding fields, which would break
+      // any sharing of the receiver's storage
+      for (int i = 0; i < (int) receiverFields.size(); i++) {
+        copyWireValueOver(receiverFields[i].second, sourceFields[i].second);
       }
 
       return;
@@ -89,557 +102,3208 @@ namespace EventSim {
 
   }
 
-  BitVector extractBitVector(const WireValue& value) {
-    assert((value.getType() == WIRE_VALUE_ARRAY) ||
-           (value.getType() == WIRE_VALUE_BIT));
-
-    if (value.getType() == WIRE_VALUE_BIT) {
-      const BitValue& bitVal = static_cast<const BitValue&>(value);
-      BitVector bv(1, 0);
-      bv.set(0, bitVal.value());
-      return bv;
+  ChangeMask updateWireBitVector(const BitVector& bv, WireValue& value) {
+    ChangeMask changed = 0;
+    for (int i = 0; i < bitWidth(value); i++) {
+      if (setBit(bitAt(&value, i), bv.get(i))) {
+        changed |= changedBit(i);
+      }
     }
+    return changed;
+  }
 
-    //cout << "Value type = " << value.getType() << endl;
-    assert(value.getType() == WIRE_VALUE_ARRAY);
+  ChangeMask updateWireValue(WireValue* const receiver,
+                             const WireValue* const source) {
+    assert(receiver->getType() == source->getType());
 
-    auto& val = static_cast<const ArrayValue&>(value);
-    BitVector bv(val.length(), 0);
-    for (int i = 0; i < val.length(); i++) {
-      auto bi = val.elem(i);
-      assert(bi->getType() == WIRE_VALUE_BIT);
-      auto bib = static_cast<const BitValue* const>(bi);
-      bv.set(i, bib->value());
+    if (receiver->getType() == WIRE_VALUE_BIT) {
+      return setBit(static_cast<BitValue* const>(receiver),
+                    static_cast<const BitValue* const>(source)->value()) ?
+        changedBit(0) : 0;
     }
 
-    return bv;
-  }
+    ChangeMask changed = 0;
+    if (receiver->getType() == WIRE_VALUE_ARRAY) {
+      ArrayValue* const receiverArray =
+        static_cast<ArrayValue* const>(receiver);
 
-  void EventSimulator::updateSignals(std::set<CoreIR::Select*>& freshSignals) {
+      const ArrayValue* const sourceArray =
+        static_cast<const ArrayValue* const>(source);
+
+      assert(receiverArray->length() == sourceArray->length());
+
+      for (int i = 0; i < receiverArray->length(); i++) {
+        if (updateWireValue(receiverArray->elemMutable(i),
+                            sourceArray->elem(i))) {
+          changed |= changedBit(i);
+        }
+      }
 
-    while (freshSignals.size() > 0) {
-      CoreIR::Select* next = *std::begin(freshSignals);
-      freshSignals.erase(next);
+      return changed;
+    }
 
-      //cout << "Updates from " << next->toString() << endl;
+    assert(receiver->getType() == WIRE_VALUE_RECORD);
 
-      // Update bits stored in v
-      //auto receiverSels = getReceiverSelects(next);
-      auto receiverSels = allReceiverSelects(next);
-      set<Wireable*> nodesToUpdate;
-      for (auto rSel : receiverSels) {
-        //cout << "\tReceives " << rSel->toString() << endl;
-        Wireable* top = rSel->getTopParent();
+    RecordValue* const receiverRecord =
+      static_cast<RecordValue* const>(receiver);
 
-        nodesToUpdate.insert(top);
-      }
+    const RecordValue* const sourceRecord =
+      static_cast<const RecordValue* const>(source);
 
-      // TODO: Update the actual node values
-      set<Wireable*> nodesWhoseOutputChanged;
-      for (auto node : nodesToUpdate) {
-        bool changed = false;
+    auto& receiverFields = receiverRecord->getFields();
+    auto& sourceFields = sourceRecord->getFields();
 
-        // Assumes no inout ports
-        if (isa<Instance>(node)) {
-          changed = updateInstance(cast<Instance>(node));
-        } else {
-          updateInputs(node);
-        }
+    assert(receiverFields.size() == sourceFields.size());
 
-        if (changed) {
-          nodesWhoseOutputChanged.insert(node);
-        }
+    for (int i = 0; i < (int) receiverFields.size(); i++) {
+      if (updateWireValue(receiverFields[i].second, sourceFields[i].second)) {
+        changed = ALL_BITS_CHANGED;
       }
+    }
 
-      // Add new signals to the fresh queue
-      for (auto node : nodesWhoseOutputChanged) {
+    return changed;
+  }
 
-        // Assumes no use of inout ports.
-        if (isa<Instance>(node)) {
-          //cout << "\tChecking outputs of " << node->toString() << endl;
-          for (auto sel : node->getSelects()) {
-            if (sel.second->getType()->getDir() == Type::DirKind::DK_Out) {
-              //cout << "\t\tis output " << sel.second->toString() << endl;
+  bool isKnown(const WireValue& value) {
+    if (value.getType() == WIRE_VALUE_BIT) {
+      return static_cast<const BitValue&>(value).value().is_binary();
+    }
 
-              freshSignals.insert(sel.second);
-            }
-          }
+    if (value.getType() == WIRE_VALUE_ARRAY) {
+      auto& arr = static_cast<const ArrayValue&>(value);
+      for (int i = 0; i < arr.length(); i++) {
+        if (!isKnown(*(arr.elem(i)))) {
+          return false;
         }
       }
+      return true;
     }
 
-    assert(freshSignals.size() == 0);
+    assert(value.getType() == WIRE_VALUE_RECORD);
 
+    for (auto& field : static_cast<const RecordValue&>(value).getFields()) {
+      if (!isKnown(*(field.second))) {
+        return false;
+      }
+    }
+    return true;
   }
 
-  void EventSimulator::updateInputs(CoreIR::Wireable* const inst) {
-    // Set the values on all instance selects?
-    //cout << "Updating " << inst->toString() << endl;
-
-    // More than 20% of the time in larger simulations is spent here.
-    for (auto conn : allSourceConnections(inst)) { //getSourceConnections(inst)) {
-      //cout << "\t" << conn.first->toString() << " <-> " << conn.second->toString() << endl;
-      Wireable* driver = conn.first;
-      Wireable* receiver = conn.second;
-      WireValue* driverValue = getWireValue(driver);
-      setValueNoUpdate(receiver, driverValue);
+  int bitWidth(const WireValue& value) {
+    if (value.getType() == WIRE_VALUE_BIT) {
+      return 1;
     }
-  }
 
-  bool EventSimulator::updateInstance(CoreIR::Instance* const inst) {
-    string opName = getQualifiedOpName(*inst);
-    //cout << "Instance type name = " << opName << endl;
+    assert(value.getType() == WIRE_VALUE_ARRAY);
+
+    return static_cast<const ArrayValue&>(value).length();
+  }
 
+  bool readKnownWord(const WireValue& value, uint64_t& word) {
+    if (value.getType() == WIRE_VALUE_BIT) {
+      bsim::quad_value b = static_cast<const BitValue&>(value).value();
+      if (!b.is_binary()) {
+        return false;
+      }
 
-    if (opName == "coreir.andr") {
-      updateInputs(inst);
+      word = b.binary_value();
+      return true;
+    }
 
-      BitVec res(1, 1);
+    if (value.getType() != WIRE_VALUE_ARRAY) {
+      return false;
+    }
 
-      // TODO: Need to add machinery to retrieve the net from a wire
-      BitVec sB = getBitVec(inst->sel("in"));
+    auto& val = static_cast<const ArrayValue&>(value);
+    if (val.length() > 64) {
+      return false;
+    }
 
-      for (int i = 0; i < sB.bitLength(); i++) {
-        if (sB.get(i) != 1) {
-          res = BitVec(1, 0);
-          break;
-        }
+    uint64_t res = 0;
+    for (int i = 0; i < val.length(); i++) {
+      auto bi = val.elem(i);
+      if (bi->getType() != WIRE_VALUE_BIT) {
+        return false;
       }
 
-      Select* outSel = inst->sel("out");
-      setValueNoUpdate(outSel, res);
+      bsim::quad_value b = static_cast<const BitValue* const>(bi)->value();
+      if (!b.is_binary()) {
+        return false;
+      }
 
-      return true;
-    } else if (opName == "coreir.mux") {
+      res |= ((uint64_t) b.binary_value()) << i;
+    }
 
-      // TODO: Find a more uniform way to check before and after conditions?
-      BitVec oldOut = getBitVec(inst->sel("out"));
+    word = res;
+    return true;
+  }
 
-      updateInputs(inst);
+  void readWord(const WireValue& value, uint64_t& word, uint64_t& unknown) {
+    word = 0;
+    unknown = 0;
 
-      BitVec sel = getBitVec(inst->sel("sel"));
-      BitVec in0 = getBitVec(inst->sel("in0"));
-      BitVec in1 = getBitVec(inst->sel("in1"));
+    int width = bitWidth(value);
+    assert(width <= 64);
 
-      // Always pick input 0 for unknown values. Could select a random
-      // value if we wanted to
-      if (sel.get(0).is_unknown()) {
-        setValueNoUpdate(inst->sel("out"), in0);
+    for (int i = 0; i < width; i++) {
+      bsim::quad_value b = bitAt(const_cast<WireValue*>(&value), i)->value();
+      if (b.is_binary()) {
+        word |= ((uint64_t) b.binary_value()) << i;
       } else {
-        if (sel.get(0).binary_value() == 0) {
-          setValueNoUpdate(inst->sel("out"), in0);
-        } else {
-          setValueNoUpdate(inst->sel("out"), in1);
-        }
-      }
-
-      if (same_representation(getBitVec(inst->sel("out")), oldOut)) {
-        return false;
+        unknown |= ((uint64_t) 1) << i;
       }
+    }
+  }
 
-      return true;
+  ChangeMask writeWord(const uint64_t word, WireValue& value) {
+    int width = bitWidth(value);
 
-    } else if (opName == "coreir.slice") {
-      Values args = inst->getModuleRef()->getGenArgs();
-      uint lo = (args["lo"])->get<int>();
-      uint hi = (args["hi"])->get<int>();
+    assert(width <= 64);
 
-      assert((hi - lo) > 0);
+    ChangeMask changed = 0;
+    for (int i = 0; i < width; i++) {
+      if (setBit(bitAt(&value, i), bsim::quad_value((word >> i) & 1))) {
+        changed |= changedBit(i);
+      }
+    }
+    return changed;
+  }
 
-      BitVec oldOut = getBitVec(inst->sel("out"));
+  uint64_t ashrWord(const uint64_t word, const uint64_t shift, const int width) {
+    uint64_t sign = (word >> (width - 1)) & 1;
+    if (shift >= ((uint64_t) width)) {
+      return sign ? ~((uint64_t) 0) : 0;
+    }
 
-      updateInputs(inst);
+    if (shift == 0) {
+      return word;
+    }
 
-      BitVec res(hi - lo, 0);
-      BitVec sB = getBitVec(inst->sel("in"));
-      for (uint i = lo; i < hi; i++) {
-        res.set(i - lo, sB.get(i));
-      }
+    uint64_t res = word >> shift;
+    if (sign) {
+      res |= ~((uint64_t) 0) << (width - shift);
+    }
+    return res;
+  }
 
-      if (same_representation(res, oldOut)) {
-        return false;
-      }
+  BitVector extractBitVector(const WireValue& value) {
+    assert((value.getType() == WIRE_VALUE_ARRAY) ||
+           (value.getType() == WIRE_VALUE_BIT));
 
-      Select* outSel = inst->sel("out");
-      setValueNoUpdate(outSel, res);
+    if (value.getType() == WIRE_VALUE_BIT) {
+      const BitValue& bitVal = static_cast<const BitValue&>(value);
+      BitVector bv(1, 0);
+      bv.set(0, bitVal.value());
+      return bv;
+    }
 
-      return true;
-      
-    } else if ((opName == "corebit.term") || (opName == "coreir.term")) {
-      return false;
-    } else if (inst->getModuleRef()->hasDef()) {
+    //cout << "Value type = " << value.getType() << endl;
+    assert(value.getType() == WIRE_VALUE_ARRAY);
 
-      // Save outputs of the module
+    auto& val = static_cast<const ArrayValue&>(value);
+    BitVector bv(val.length(), 0);
+    for (int i = 0; i < val.length(); i++) {
+      auto bi = val.elem(i);
+      assert(bi->getType() == WIRE_VALUE_BIT);
+      auto bib = static_cast<const BitValue* const>(bi);
+      bv.set(i, bib->value());
+    }
 
-      map<Select*, BitVec> oldOutputs =
-        outputBitVecs(inst);
+    return bv;
+  }
 
-      updateInputs(inst);
+  // The port of its top parent that w is part of
+  static CoreIR::Select* topPort(CoreIR::Wireable* const w) {
+    Select* port = cast<Select>(w);
+    while (isa<Select>(port->getParent())) {
+      port = cast<Select>(port->getParent());
+    }
+    return port;
+  }
 
-      EventSimulator* sim = submodules[inst];
-      sim->setValueNoUpdate(sim->getSelf(), getWireValue(inst));
+  ModuleTemplate::ModuleTemplate(CoreIR::Module* const mod_,
+                                 const bool pruneDeadLogic,
+                                 const bool aliasWires) : mod(mod_) {
+    assert(mod->hasDef());
 
-      std::set<CoreIR::Select*> freshSignals;
+    auto def = mod->getDef();
+    Wireable* self = def->sel("self");
 
-      // cout << "Updating " << inst->toString() << " : " << opName << endl;
-      for (auto selR : sim->getSelf()->getSelects()) {
+    // Selecting the interface creates its selects, so this comes before
+    // the fan-out of self is recorded
+    RecordType* modType = cast<RecordType>(mod->getType());
+    for (auto& field : modType->getFields()) {
+      portDirections.push_back(modType->getRecord().at(field)->getDir());
+      portSelects.push_back(self->sel(field));
+    }
 
-        Select* sel = selR.second;
-        if (sel->getType()->getDir() == Type::DK_Out) {
-          // cout << "\tAdding " << sel->toString() << endl;
-          // cout << "\tWith vaule " << sim->getBitVec(sel->sel("sel")) << endl;
-          freshSignals.insert(sel);
+    defaultValues[self] = defaultWireValue(self);
+    sourceConnections[self] = getSourceConnections(self);
+    addReceiverSelects(self);
+
+    for (auto instR : def->getInstances()) {
+      Instance* inst = instR.second;
+
+      defaultValues[inst] = defaultWireValue(inst);
+      sourceConnections[inst] = getSourceConnections(inst);
+
+      // Selecting the ports creates them, so this comes before the fan-out
+      // of every select is recorded
+      auto ports = cast<RecordType>(inst->getType())->getRecord();
+      auto port = [inst, &ports](const std::string& name) {
+        return contains_key(name, ports) ? inst->sel(name) : nullptr;
+      };
+
+      InstanceInfo& info = instanceInfo[inst];
+      info.index = instanceInfo.size() - 1;
+      info.op = resolveOpCode(inst);
+      info.params = decodeParams(inst, info.op);
+      info.in0 = port("in0");
+      info.in1 = port("in1");
+      info.in = port("in");
+      info.sel = port("sel");
+      info.clk = port("clk");
+      info.arst = port("arst");
+      info.out = port("out");
+
+      info.outputs.clear();
+      RecordType* instType = cast<RecordType>(inst->getType());
+      for (auto& field : instType->getFields()) {
+        if (ports.at(field)->getDir() == Type::DK_Out) {
+          info.outputs.push_back(inst->sel(field));
         }
       }
-      sim->updateSignals(freshSignals);
 
-      setValueNoUpdate(inst, sim->getSelfValue());
+      addReceiverSelects(inst);
+    }
 
-      map<Select*, BitVec> newOutputs =
-        outputBitVecs(inst);
+    for (auto instR : def->getInstances()) {
+      instanceNames[instR.first] = {instR.second, instR.second->getModuleRef()};
+    }
+    fanInKeys = currentFanInKeys();
 
-      assert(newOutputs.size() == oldOutputs.size());
+    if (aliasWires) {
+      findAliases();
+    } else {
+      copiedConnections = sourceConnections;
+    }
 
-      for (auto out : newOutputs) {
-        assert(contains_key(out.first, oldOutputs));
-        if (!same_representation(out.second, oldOutputs.at(out.first))) {
-          return true;
-        }
-      }
+    findRegisterGroups();
+    findEventReceivers();
+    rankInstances();
+    indexCones();
 
-      return false;
-      
-    } else if ((opName == "corebit.reg") || (opName == "coreir.reg")) {
+    vector<int> path;
+    indexSelects(self, getDefaultValue(self), self, path);
+    for (auto instR : def->getInstances()) {
+      Instance* inst = instR.second;
+      indexSelects(inst, getDefaultValue(inst), inst, path);
+    }
 
-      BitVec oldOut = getBitVec(inst->sel("out"));
-      BitVec oldClk = getBitVec(inst->sel("clk"));
-      
-      updateInputs(inst);
+    if (pruneDeadLogic) {
+      findDeadInstances();
+    }
+  }
 
-      BitVec clk = getBitVec(inst->sel("clk"));
-      bool updateOnPosedge =
-        inst->getModArgs().at("clk_posedge")->get<bool>();
+  std::map<std::string, std::string> ModuleTemplate::currentFanInKeys() const {
+    auto def = mod->getDef();
 
-      // TODO: Add x considerations
-      bool posedge = (clk == BitVec(1, 1)) && (oldClk == BitVec(1, 0));
-      bool negedge = (clk == BitVec(1, 0)) && (oldClk == BitVec(1, 1));
+    map<string, Wireable*> nodes;
+    nodes["self"] = def->sel("self");
+    for (auto instR : def->getInstances()) {
+      nodes[instR.first] = instR.second;
+    }
 
-      if (updateOnPosedge && posedge) {
-        setValueNoUpdate(inst->sel("out"), getWireValue(inst->sel("in")));
-      } else if (!updateOnPosedge && negedge) {
-        setValueNoUpdate(inst->sel("out"), getWireValue(inst->sel("in")));
+    map<string, string> keys;
+    for (auto node : nodes) {
+      vector<string> conns;
+      for (auto& conn : getSourceConnections(node.second)) {
+        conns.push_back(conn.first->toString() + " -> " + conn.second->toString());
       }
+      std::sort(begin(conns), end(conns));
 
-      BitVec out = getBitVec(inst->sel("out"));
-          
-      return !same_representation(oldOut, out);
-    } else if (opName == "coreir.wrap") {
-
-      // Assuming no wrapping of record or array of array types for now.
-      // Only existing named types are clk and reset
-      return updateUnopNode(inst, [](const BitVec& l) {
-          return l;
-        });
+      string key;
+      for (auto& conn : conns) {
+        key += conn + "\n";
+      }
+      keys[node.first] = key;
+    }
 
-    } else if (opName == "coreir.reg_arst") {
+    return keys;
+  }
 
-      BitVec oldOut = getBitVec(inst->sel("out"));
-      BitVec oldClk = getBitVec(inst->sel("clk"));
-      BitVec oldRst = getBitVec(inst->sel("arst"));
-      
-      updateInputs(inst);
+  bool ModuleTemplate::matchesDefinition() const {
+    const auto& instances = mod->getDef()->getInstances();
+    if (instances.size() != instanceNames.size()) {
+      return false;
+    }
 
-      BitVec clk = getBitVec(inst->sel("clk"));
-      BitVec rst = getBitVec(inst->sel("arst"));
+    for (auto instR : instances) {
+      if (!hadInstance(instR.second)) {
+        return false;
+      }
+    }
 
-      // cout << "Getting initval" << endl;
-      // cout << "Init value type = " << inst->getModArgs().at("init")->getValueType()->toString() << endl;
+    return currentFanInKeys() == fanInKeys;
+  }
 
-      // int width = inst->getModuleRef()->getGenArgs().at("width")->get<int>();
+  void ModuleTemplate::indexSelects(CoreIR::Wireable* const w,
+                                    const WireValue* const value,
+                                    CoreIR::Wireable* const top,
+                                    std::vector<int>& path) {
+    for (auto selR : w->getSelects()) {
+      const WireValue* child = nullptr;
+      if (value->getType() == WIRE_VALUE_RECORD) {
+        auto& fields = static_cast<const RecordValue*>(value)->getFields();
+        for (int i = 0; i < (int) fields.size(); i++) {
+          if (fields[i].first == selR.first) {
+            path.push_back(i);
+            child = fields[i].second;
+            break;
+          }
+        }
+      } else {
+        assert(value->getType() == WIRE_VALUE_ARRAY);
 
-      // TODO: Add real initilization value later. For now I cant get this to
-      // work.
-      //auto modArgs = inst->getModArgs();
+        int i = std::stoi(selR.first);
+        path.push_back(i);
+        child = static_cast<const ArrayValue*>(value)->elem(i);
+      }
 
-      // cout << "Module args" << endl;
-      // for (auto arg : modArgs) {
-      //   cout << "\t" << arg.first << " -> " << arg.second->toString() << " : " << arg.second->getKind() << endl;
-      // }
+      assert(child != nullptr);
 
-      //Value* initArg = modArgs.at("init");
-      Value* initValueArg = inst->getModArgs().at("init");
-      //cout << "initValueArg kind = " << initValueArg->getKind() << endl;
-      BitVector initVal(1, 1);
-      if (initValueArg->getKind() == Value::ValueKind::VK_Arg) {
-        //ModuleDef* def = inst->getContainer();
-        //Module* mod = def->getModule();
-        //initVal = mod->getModParams().at("init")->get<BitVector>();
+      selectSlots[selR.second] = selectPaths.size();
+      selectPaths.push_back({top, path});
 
-        // Maybe the thing to do here is save a pointer in the simulator
-        // back to 
-        //cout << "Symbolic init value contained in " << mod->toString() << endl;
+      indexSelects(selR.second, child, top, path);
 
-        Instance* beingSimulated = getInstanceBeingSimulated();
-        assert(beingSimulated != nullptr);
+      path.pop_back();
+    }
+  }
 
-        //cout << "Instance being simulated = " << beingSimulated->toString();
+  void ModuleTemplate::findRegisterGroups() {
+    map<pair<Select*, bool>, int> groupIndices;
+    for (auto instR : mod->getDef()->getInstances()) {
+      Instance* inst = instR.second;
+      OpCode op = getOpCode(inst);
+      if ((op != OP_REG) && (op != OP_REG_ARST)) {
+        continue;
+      }
 
-        initVal = beingSimulated->getModArgs().at("init")->get<BitVector>();
-      } else {
-        initVal = inst->getModArgs().at("init")->get<BitVector>();
+      Select* clock = nullptr;
+      for (auto& conn : getFanIn(inst)) {
+        if (topPort(conn.second)->getSelStr() == "clk") {
+          clock = aliasRoot(cast<Select>(conn.first));
+        }
       }
 
-      //cout << "initval = " << initVal << endl;
+      // Registers with no clock never change on a clock edge
+      if (clock == nullptr) {
+        continue;
+      }
 
-      bool updateOnPosedge =
-        inst->getModArgs().at("clk_posedge")->get<bool>();
+      bool posedge = getInstanceInfo(inst).params.clkPosedge;
+      if (!contains_key(make_pair(clock, posedge), groupIndices)) {
+        groupIndices[{clock, posedge}] = registerGroups.size();
+        clockedGroups[topPort(clock)].push_back(registerGroups.size());
+        registerGroups.push_back({clock, posedge, {}});
+      }
 
-      bool resetOnPosedge =
-        inst->getModArgs().at("arst_posedge")->get<bool>();
-      
-      // TODO: Add x considerations
-      bool posedgeClk = (clk == BitVec(1, 1)) && (oldClk == BitVec(1, 0));
-      bool negedgeClk = (clk == BitVec(1, 0)) && (oldClk == BitVec(1, 1));
+      registerGroups[groupIndices.at({clock, posedge})].registers.push_back(inst);
+      groupedRegisters.insert(inst);
+    }
+  }
 
-      if (updateOnPosedge && posedgeClk) {
-        // cout << "Posedge Clocking VALUE OF " << inst->toString() << endl;
-        // cout << "value of input = " << getBitVec(inst->sel("in")) << endl;
-        setValueNoUpdate(inst->sel("out"), getWireValue(inst->sel("in")));
-      } else if (!updateOnPosedge && negedgeClk) {
+  void ModuleTemplate::findEventReceivers() {
+    map<Select*, Select*> drivers;
+    for (auto& nodeConns : sourceConnections) {
+      for (auto& conn : nodeConns.second) {
+        if (isa<Select>(conn.first) && isa<Select>(conn.second)) {
+          drivers[cast<Select>(conn.second)] = cast<Select>(conn.first);
+        }
+      }
+    }
 
-        // cout << "Negedge Clocking VALUE OF " << inst->toString() << endl;
-        // cout << "value of input = " << getBitVec(inst->sel("in")) << endl;
+    for (auto& fanOut : receiverSelects) {
+      vector<Select*>& receivers = eventReceivers[fanOut.first];
+      vector<ChangeMask>& masks = consumedBits[fanOut.first];
+      for (auto receiver : fanOut.second) {
+
+        // Register groups sample data inputs on clock edges, so changes
+        // to them alone never need to evaluate the register
+        Wireable* top = receiver->getTopParent();
+        if (isa<Instance>(top) &&
+            dbhc::elem(cast<Instance>(top), groupedRegisters)) {
+          string port = topPort(receiver)->getSelStr();
+          if ((port == "in") || (port == "clk")) {
+            continue;
+          }
+        }
 
-        setValueNoUpdate(inst->sel("out"), getWireValue(inst->sel("in")));
+        receivers.push_back(receiver);
+        masks.push_back(contains_key(receiver, drivers) ?
+                        consumedBitsOf(receiver, drivers.at(receiver)) :
+                        ALL_BITS_CHANGED);
       }
+    }
+  }
 
-      bool posedgeRst = (rst == BitVec(1, 1)) && (oldRst == BitVec(1, 0));
-      bool negedgeRst = (rst == BitVec(1, 0)) && (oldRst == BitVec(1, 1));
-      
-      // Reset has priority over clock
-      if (resetOnPosedge && posedgeRst) {
-        // cout << "RESETING VALUE OF " << inst->toString() << endl;
-        setValueNoUpdate(inst->sel("out"), initVal);
-      } else if (!resetOnPosedge && negedgeRst) {
-        setValueNoUpdate(inst->sel("out"), initVal);
+  // Numbers the strongly connected components of a graph in reverse
+  // topological order using Tarjan's algorithm with an explicit stack,
+  // since chains of logic can be deeper than the call stack. Returns the
+  // number of components.
+  static int findComponents(const vector<vector<int> >& successors,
+                            vector<int>& component) {
+    int numNodes = successors.size();
+    vector<int> order(numNodes, -1);
+    vector<int> lowLink(numNodes, 0);
+    vector<bool> onStack(numNodes, false);
+    vector<int> stack;
+    vector<pair<int, int> > work;
+    int numVisited = 0;
+    int numComponents = 0;
+
+    component.assign(numNodes, -1);
+
+    auto visit = [&](const int v) {
+      order[v] = numVisited;
+      lowLink[v] = numVisited;
+      numVisited++;
+      stack.push_back(v);
+      onStack[v] = true;
+      work.push_back({v, 0});
+    };
+
+    for (int start = 0; start < numNodes; start++) {
+      if (order[start] != -1) {
+        continue;
       }
 
-      BitVec out = getBitVec(inst->sel("out"));
-          
-      return !same_representation(oldOut, out);
-      
-    } else if (opName == "coreir.zext") {
-
-      uint inWidth = inst->getModuleRef()->getGenArgs().at("width_in")->get<int>();
-      uint outWidth = inst->getModuleRef()->getGenArgs().at("width_out")->get<int>();
-    
-      BitVec oldOut = getBitVec(inst->sel("out"));
+      visit(start);
+      while (work.size() > 0) {
+        int v = work.back().first;
 
-      updateInputs(inst);
+        if (work.back().second < (int) successors[v].size()) {
+          int w = successors[v][work.back().second];
+          work.back().second++;
 
-      BitVec bv1 = getBitVec(inst->sel("in"));      
+          if (order[w] == -1) {
+            visit(w);
+          } else if (onStack[w]) {
+            lowLink[v] = std::min(lowLink[v], order[w]);
+          }
+          continue;
+        }
 
-      assert(((uint) bv1.bitLength()) == inWidth);
+        work.pop_back();
+        if (work.size() > 0) {
+          int parent = work.back().first;
+          lowLink[parent] = std::min(lowLink[parent], lowLink[v]);
+        }
 
-      BitVec res(outWidth, 0);
-      for (uint i = 0; i < inWidth; i++) {
-        res.set(i, bv1.get(i));
+        if (lowLink[v] == order[v]) {
+          int w = -1;
+          do {
+            w = stack.back();
+            stack.pop_back();
+            onStack[w] = false;
+            component[w] = numComponents;
+          } while (w != v);
+          numComponents++;
+        }
       }
+    }
 
-      setValueNoUpdate(inst->sel("out"), res);
+    return numComponents;
+  }
 
-      return !same_representation(res, oldOut);
+  // Ranks strongly connected components of the graph of combinational
+  // connections between instances in topological order. Registers only
+  // depend combinationally on their async reset. Submodules are assumed
+  // to connect every input to every output.
+  void ModuleTemplate::rankInstances() {
+    const auto& instances = mod->getDef()->getInstances();
+    int numNodes = instances.size();
+
+    vector<Instance*> nodes(numNodes);
+    for (auto& instR : instances) {
+      nodes[getInstanceInfo(instR.second).index] = instR.second;
+    }
 
-    } else if (opName == "coreir.eq") {
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return BitVec(1, l == r);
-        });
+    vector<vector<int> > successors(numNodes);
+    vector<bool> selfLoop(numNodes, false);
+    for (auto& fanOut : receiverSelects) {
+      Wireable* driverTop = fanOut.first->getTopParent();
+      if (!isa<Instance>(driverTop)) {
+        continue;
+      }
 
-    } else if ((opName == "coreir.and") || (opName == "corebit.and")) {
+      int from = getInstanceInfo(cast<Instance>(driverTop)).index;
+      for (auto receiver : fanOut.second) {
+        Wireable* top = receiver->getTopParent();
+        if (!isa<Instance>(top)) {
+          continue;
+        }
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return l & r;
-        });
-      
-    } else if ((opName == "coreir.or") || (opName == "corebit.or")) {
+        const InstanceInfo& info = getInstanceInfo(cast<Instance>(top));
+        if (((info.op == OP_REG) || (info.op == OP_REG_ARST)) &&
+            (topPort(receiver)->getSelStr() != "arst")) {
+          continue;
+        }
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return l | r;
-        });
-      
-    } else if ((opName == "coreir.xor") || (opName == "corebit.xor")) {
+        successors[from].push_back(info.index);
+        if (info.index == from) {
+          selfLoop[from] = true;
+        }
+      }
+    }
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return l ^ r;
-        });
-      
-    } else if (opName == "coreir.shl") {
+    vector<int> component;
+    int numComponents = findComponents(successors, component);
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return bsim::shl(l, r);
-        });
+    vector<vector<Instance*> > members(numComponents);
+    for (int v = 0; v < numNodes; v++) {
+      int rank = numComponents - 1 - component[v];
+      instanceInfo.at(nodes[v]).rank = rank;
+      members[rank].push_back(nodes[v]);
+    }
 
-    } else if (opName == "coreir.ashr") {
+    loops.clear();
+    rankLoops.assign(numComponents, -1);
+    for (int rank = 0; rank < numComponents; rank++) {
+      Instance* first = members[rank][0];
+      if ((members[rank].size() > 1) ||
+          selfLoop[getInstanceInfo(first).index]) {
+        rankLoops[rank] = loops.size();
+        loops.push_back(members[rank]);
+      }
+    }
+  }
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return bsim::ashr(l, r);
-        });
+  // Sorts ranges and merges the ones that overlap or touch
+  static IntervalList coalesce(IntervalList& ranges) {
+    std::sort(begin(ranges), end(ranges));
 
+    IntervalList merged;
+    for (auto& range : ranges) {
+      if ((merged.size() > 0) && (range.first <= merged.back().second)) {
+        merged.back().second = std::max(merged.back().second, range.second);
+      } else {
+        merged.push_back(range);
+      }
+    }
+    return merged;
+  }
+
+  // The ids of every node reachable from each component of graph, given
+  // components numbered so that every edge leaving a component goes to a
+  // component with a smaller number
+  static vector<IntervalList> reachableIds(const vector<vector<int> >& graph,
+                                           const vector<int>& component,
+                                           const int numComponents,
+                                           const vector<int>& ids) {
+    vector<vector<int> > members(numComponents);
+    for (int v = 0; v < (int) graph.size(); v++) {
+      members[component[v]].push_back(v);
+    }
+
+    vector<IntervalList> cones(numComponents);
+    for (int c = 0; c < numComponents; c++) {
+      IntervalList ranges;
+      bool cyclic = members[c].size() > 1;
+      for (auto v : members[c]) {
+        for (auto w : graph[v]) {
+          if (component[w] == c) {
+            cyclic = true;
+            continue;
+          }
+
+          ranges.push_back({ids[w], ids[w] + 1});
+          concat(ranges, cones[component[w]]);
+        }
+      }
+
+      if (cyclic) {
+        for (auto v : members[c]) {
+          ranges.push_back({ids[v], ids[v] + 1});
+        }
+      }
+      cones[c] = coalesce(ranges);
+    }
+    return cones;
+  }
+
+  // Numbers the interface and every instance so that drivers come before
+  // the nodes they drive, which keeps most cones down to a few intervals,
+  // and computes the transitive drivers and loads of every node. Registers
+  // are walked through. The interface is where cones stop: it drives its
+  // inputs but its outputs are not traced back to them, and the reverse
+  // for loads.
+  void ModuleTemplate::indexCones() {
+    Wireable* self = mod->getDef()->sel("self");
+    const auto& instances = mod->getDef()->getInstances();
+    int numNodes = instances.size() + 1;
+
+    vector<Wireable*> nodes(numNodes);
+    for (auto& instR : instances) {
+      nodes[getInstanceInfo(instR.second).index] = instR.second;
+    }
+    nodes[numNodes - 1] = self;
+
+    auto nodeIndex = [this, self, numNodes](Wireable* const top) {
+      return top == self ? numNodes - 1 :
+        getInstanceInfo(cast<Instance>(top)).index;
+    };
+
+    vector<vector<int> > drivenBy(numNodes);
+    vector<vector<int> > drives(numNodes);
+    for (auto& fanOut : receiverSelects) {
+      int from = nodeIndex(fanOut.first->getTopParent());
+      for (auto receiver : fanOut.second) {
+        int to = nodeIndex(receiver->getTopParent());
+        if (to != numNodes - 1) {
+          drivenBy[to].push_back(from);
+        }
+        if (from != numNodes - 1) {
+          drives[from].push_back(to);
+        }
+      }
+    }
+
+    // Components of drivenBy are numbered drivers first
+    vector<int> driverComponent;
+    int numDriverComponents = findComponents(drivenBy, driverComponent);
+
+    vector<int> ids(numNodes);
+    vector<int> componentStart(numDriverComponents + 1, 0);
+    for (int v = 0; v < numNodes; v++) {
+      componentStart[driverComponent[v] + 1]++;
+    }
+    for (int c = 0; c < numDriverComponents; c++) {
+      componentStart[c + 1] += componentStart[c];
+    }
+    for (int v = 0; v < numNodes; v++) {
+      ids[v] = componentStart[driverComponent[v]]++;
+    }
+
+    coneNodes.assign(numNodes, nullptr);
+    coneIds.clear();
+    for (int v = 0; v < numNodes; v++) {
+      coneNodes[ids[v]] = nodes[v];
+      coneIds[nodes[v]] = ids[v];
+    }
+
+    driverCones = reachableIds(drivenBy, driverComponent, numDriverComponents, ids);
+    driverConeOf.assign(numNodes, -1);
+    for (int v = 0; v < numNodes; v++) {
+      driverConeOf[ids[v]] = driverComponent[v];
+    }
+
+    vector<int> loadComponent;
+    int numLoadComponents = findComponents(drives, loadComponent);
+    loadCones = reachableIds(drives, loadComponent, numLoadComponents, ids);
+    loadConeOf.assign(numNodes, -1);
+    for (int v = 0; v < numNodes; v++) {
+      loadConeOf[ids[v]] = loadComponent[v];
+    }
+
+    // Drivers that end a walk back through the fan-in: ports of the
+    // interface and of instances with no inputs connected
+    leafDrivers.assign(numNodes, vector<Select*>());
+    for (int v = 0; v < numNodes; v++) {
+      for (auto& conn : sourceConnections.at(nodes[v])) {
+        Select* driver = cast<Select>(conn.first);
+        Wireable* top = driver->getTopParent();
+        if ((top == self) || (sourceConnections.at(top).size() == 0)) {
+          leafDrivers[ids[v]].push_back(driver);
+        }
+      }
+    }
+  }
+
+  static bool containsId(const IntervalList& cone, const int id) {
+    auto after = std::upper_bound(begin(cone), end(cone),
+                                  std::make_pair(id, std::numeric_limits<int>::max()));
+    return (after != begin(cone)) && (id < (after - 1)->second);
+  }
+
+  bool ModuleTemplate::isTransitiveDriver(CoreIR::Wireable* const driver,
+                                          CoreIR::Wireable* const node) const {
+    return containsId(getDriverCone(node), getConeId(driver));
+  }
+
+  std::vector<CoreIR::Wireable*>
+  ModuleTemplate::coneMembers(const IntervalList& cone) const {
+    vector<Wireable*> members;
+    for (auto& range : cone) {
+      for (int id = range.first; id < range.second; id++) {
+        members.push_back(coneNodes[id]);
+      }
+    }
+    return members;
+  }
+
+  // Bit selects of an array port read one bit of it and slices read a
+  // range. Anything else is assumed to read every bit of the port.
+  ChangeMask ModuleTemplate::consumedBitsOf(CoreIR::Select* const receiver,
+                                            CoreIR::Select* const driver) {
+    Wireable* driverTop = driver->getTopParent();
+    if (isa<Instance>(driverTop) &&
+        dbhc::elem(cast<Instance>(driverTop), aliasedWraps)) {
+      return ALL_BITS_CHANGED;
+    }
+
+    Select* port = topPort(driver);
+    if ((driver != port) &&
+        (driver->getParent() == port) &&
+        (port->getType()->getKind() == Type::TK_Array)) {
+      return changedBit(std::stoi(driver->getSelStr()));
+    }
+
+    Wireable* receiverTop = receiver->getTopParent();
+    if ((driver == port) &&
+        isa<Instance>(receiverTop) &&
+        (receiver->getParent() == receiverTop) &&
+        (receiver->getSelStr() == "in") &&
+        (getOpCode(cast<Instance>(receiverTop)) == OP_SLICE)) {
+      const InstanceParams& params =
+        getInstanceInfo(cast<Instance>(receiverTop)).params;
+      return changedRange(params.lo, params.hi);
+    }
+
+    return ALL_BITS_CHANGED;
+  }
+
+  void ModuleTemplate::findAliases() {
+    auto def = mod->getDef();
+
+    // Named types are only used for clocks and resets, so wraps between
+    // single bits are the identity on values
+    for (auto instR : def->getInstances()) {
+      Instance* inst = instR.second;
+      if (getOpCode(inst) != OP_WRAP) {
+        continue;
+      }
+
+      const RecordValue* ports =
+        static_cast<const RecordValue*>(getDefaultValue(inst));
+      if ((ports->getFieldValue("in")->getType() == WIRE_VALUE_BIT) &&
+          (ports->getFieldValue("out")->getType() == WIRE_VALUE_BIT)) {
+        aliasedWraps.insert(inst);
+      }
+    }
+
+    for (auto& nodeConns : sourceConnections) {
+      vector<Connection>& copied = copiedConnections[nodeConns.first];
+
+      for (auto& conn : nodeConns.second) {
+        if (canAlias(conn)) {
+          aliases.push_back({cast<Select>(conn.second),
+                aliasRoot(cast<Select>(conn.first))});
+        } else {
+          copied.push_back(conn);
+        }
+      }
+    }
+
+    for (auto wrap : aliasedWraps) {
+      aliases.push_back({wrap->sel("out"), aliasRoot(wrap->sel("out"))});
+    }
+
+    for (auto& fanOut : receiverSelects) {
+      vector<Select*> expanded;
+      addAliasedReceivers(fanOut.second, expanded);
+      fanOut.second = expanded;
+    }
+  }
+
+  // Registers compare the old and new values of their clock and reset
+  // inputs, so those inputs keep their own storage.
+  bool ModuleTemplate::canAlias(const CoreIR::Connection& conn) {
+    if (!isa<Select>(conn.first) || !isa<Select>(conn.second)) {
+      return false;
+    }
+
+    Select* driver = cast<Select>(conn.first);
+    Select* receiver = cast<Select>(conn.second);
+    if ((driver->getType()->getDir() != Type::DK_Out) ||
+        (receiver->getType()->getDir() != Type::DK_In)) {
+      return false;
+    }
+
+    Wireable* top = receiver->getTopParent();
+    if (isa<Instance>(top)) {
+      OpCode op = getOpCode(cast<Instance>(top));
+      string port = topPort(receiver)->getSelStr();
+      if (((op == OP_REG) || (op == OP_REG_ARST)) &&
+          ((port == "clk") || (port == "arst"))) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // The driver whose storage is shared by everything driver drives
+  CoreIR::Select* ModuleTemplate::aliasRoot(CoreIR::Select* const driver) {
+    Wireable* top = driver->getTopParent();
+    if (!isa<Instance>(top) ||
+        !dbhc::elem(cast<Instance>(top), aliasedWraps)) {
+      return driver;
+    }
+
+    Instance* wrap = cast<Instance>(top);
+    for (auto& conn : getFanIn(wrap)) {
+      return aliasRoot(cast<Select>(conn.first));
+    }
+
+    return wrap->sel("in");
+  }
+
+  void ModuleTemplate::addAliasedReceivers(const std::vector<CoreIR::Select*>& receivers,
+                                           std::vector<CoreIR::Select*>& expanded) {
+    for (auto receiver : receivers) {
+      Wireable* top = receiver->getTopParent();
+      if (isa<Instance>(top) &&
+          dbhc::elem(cast<Instance>(top), aliasedWraps)) {
+        addAliasedReceivers(getFanOut(cast<Instance>(top)->sel("out")),
+                            expanded);
+      } else {
+        expanded.push_back(receiver);
+      }
+    }
+  }
+
+  void ModuleTemplate::findDeadInstances() {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+
+      for (auto instR : mod->getDef()->getInstances()) {
+        Instance* inst = instR.second;
+        if (isPruned(inst)) {
+          continue;
+        }
+
+        bool live = false;
+        for (auto selR : inst->getSelects()) {
+          if (selR.second->getType()->getDir() != Type::DK_Out) {
+            continue;
+          }
+
+          for (auto receiver : getFanOut(selR.second)) {
+            Wireable* top = receiver->getTopParent();
+            if (!isa<Instance>(top) ||
+                ((getOpCode(cast<Instance>(top)) != OP_TERM) &&
+                 !isPruned(top))) {
+              live = true;
+              break;
+            }
+          }
+
+          if (live) {
+            break;
+          }
+        }
+
+        if (!live) {
+          prunedNodes.insert(inst);
+          changed = true;
+        }
+      }
+    }
+  }
+
+  void ModuleTemplate::addReceiverSelects(CoreIR::Wireable* const w) {
+    for (auto selR : w->getSelects()) {
+      Select* sel = selR.second;
+      receiverSelects[sel] = getReceiverSelects(sel);
+      addReceiverSelects(sel);
+    }
+  }
+
+  OpCode resolveOpCode(CoreIR::Instance* const inst) {
+    string opName = getQualifiedOpName(*inst);
+
+    if (opName == "coreir.andr") {
+      return OP_ANDR;
+    } else if (opName == "coreir.mux") {
+      return OP_MUX;
+    } else if (opName == "coreir.slice") {
+      return OP_SLICE;
+    } else if ((opName == "corebit.term") || (opName == "coreir.term")) {
+      return OP_TERM;
+    } else if (inst->getModuleRef()->hasDef()) {
+      return OP_SUBMODULE;
+    } else if (opName == "corebit.const") {
+      return OP_BIT_CONST;
+    } else if (opName == "coreir.const") {
+      return OP_CONST;
+    } else if ((opName == "corebit.reg") || (opName == "coreir.reg")) {
+      return OP_REG;
+    } else if (opName == "coreir.wrap") {
+      return OP_WRAP;
+    } else if (opName == "coreir.reg_arst") {
+      return OP_REG_ARST;
+    } else if (opName == "coreir.zext") {
+      return OP_ZEXT;
+    } else if (opName == "coreir.eq") {
+      return OP_EQ;
+    } else if ((opName == "coreir.and") || (opName == "corebit.and")) {
+      return OP_AND;
+    } else if ((opName == "coreir.or") || (opName == "corebit.or")) {
+      return OP_OR;
+    } else if ((opName == "coreir.xor") || (opName == "corebit.xor")) {
+      return OP_XOR;
+    } else if (opName == "coreir.shl") {
+      return OP_SHL;
+    } else if (opName == "coreir.ashr") {
+      return OP_ASHR;
     } else if (opName == "coreir.lshr") {
+      return OP_LSHR;
+    } else if (opName == "coreir.sub") {
+      return OP_SUB;
+    } else if (opName == "coreir.mul") {
+      return OP_MUL;
+    } else if (opName == "coreir.add") {
+      return OP_ADD;
+    } else if ((opName == "coreir.neq") || (opName == "corebit.neq")) {
+      return OP_NEQ;
+    } else if (opName == "coreir.ult") {
+      return OP_ULT;
+    } else if (opName == "coreir.ule") {
+      return OP_ULE;
+    } else if (opName == "coreir.uge") {
+      return OP_UGE;
+    } else if ((opName == "coreir.not") || (opName == "corebit.not")) {
+      return OP_NOT;
+    } else if ((opName == "coreir.mem") ||
+               (opName == "global.input_sr_unq1") ||
+               (opName == "global.output_sr_unq1")) {
+      return OP_UNIMPLEMENTED;
+    } else if (opName == "coreir.orr") {
+      return OP_ORR;
+    }
+
+    return OP_UNSUPPORTED;
+  }
+
+  InstanceParams decodeParams(CoreIR::Instance* const inst, const OpCode op) {
+    InstanceParams params = {0, 0, 0, 0, true, true, false};
+
+    if (op == OP_SLICE) {
+      Values args = inst->getModuleRef()->getGenArgs();
+      params.lo = args.at("lo")->get<int>();
+      params.hi = args.at("hi")->get<int>();
+
+      assert((params.hi - params.lo) > 0);
+    } else if (op == OP_ZEXT) {
+      Values args = inst->getModuleRef()->getGenArgs();
+      params.widthIn = args.at("width_in")->get<int>();
+      params.widthOut = args.at("width_out")->get<int>();
+    } else if ((op == OP_REG) || (op == OP_REG_ARST)) {
+      Values args = inst->getModArgs();
+      params.clkPosedge = args.at("clk_posedge")->get<bool>();
+
+      if (op == OP_REG_ARST) {
+        params.arstPosedge = args.at("arst_posedge")->get<bool>();
+        params.symbolicInit =
+          args.at("init")->getKind() == Value::ValueKind::VK_Arg;
+      }
+    }
+
+    return params;
+  }
+
+  WireValue* ModuleTemplate::defaultWireValue(CoreIR::Wireable* const w) {
+    WireValue* val = nullptr;
+    if (w->getType()->getKind() == CoreIR::Type::TK_Record) {
+
+      std::vector<std::pair<std::string, WireValue*> > fields;
+      CoreIR::RecordType* tp = CoreIR::cast<CoreIR::RecordType>(w->getType());
+      for (auto field : tp->getFields()) {
+        fields.push_back({field, defaultWireValue(w->sel(field))});
+      }
+      val = new RecordValue(fields);
+        
+    } else if (CoreIR::isa<CoreIR::ArrayType>(w->getType())) {
+
+      CoreIR::ArrayType* arrTp = CoreIR::cast<CoreIR::ArrayType>(w->getType());
+
+      std::vector<WireValue*> arrValues;
+      for (int i = 0; i < (int) arrTp->getLen(); i++) {
+        arrValues.push_back(defaultWireValue(w->sel(i)));
+      }
+      val = new ArrayValue(arrValues);
+
+    } else if (isBitType(*(w->getType()))) {
+      val = new BitValue(bsim::quad_value(QBV_UNKNOWN_VALUE));
+    } else if (CoreIR::isa<CoreIR::NamedType>(w->getType())) {
+
+      CoreIR::NamedType* tp =
+        CoreIR::cast<CoreIR::NamedType>(w->getType());
+
+      // Currently we only handle bit types
+      assert(isBitType(*(tp->getRaw())));
+
+      val = new BitValue(bsim::quad_value(QBV_UNKNOWN_VALUE));
+        
+    } else {
+      cout << "ERROR: Unsupported wireable " << w->toString() << endl;
+      assert(false);
+    }
+
+    assert(val != nullptr);
+
+    ownedValues.push_back(val);
+
+    return val;
+  }
+
+  ModuleTemplate* ModuleTemplateCache::build(CoreIR::Module* const mod,
+                                             ModuleTemplateCache* const previous) {
+    if (contains_key(mod, templates)) {
+      return templates.at(mod);
+    }
+
+    ModuleTemplate* tmpl = nullptr;
+    if (previous != nullptr) {
+      tmpl = previous->release(mod);
+    }
+    if (tmpl == nullptr) {
+      tmpl = new ModuleTemplate(mod, pruneDeadLogic, aliasWires);
+    }
+    templates[mod] = tmpl;
+
+    for (auto instR : mod->getDef()->getInstances()) {
+      Module* instMod = instR.second->getModuleRef();
+      if (instMod->hasDef()) {
+        build(instMod, previous);
+      }
+    }
+
+    return tmpl;
+  }
+
+  ModuleTemplate* ModuleTemplateCache::release(CoreIR::Module* const mod) {
+    if (!contains_key(mod, templates) || !templates.at(mod)->matchesDefinition()) {
+      return nullptr;
+    }
+
+    ModuleTemplate* tmpl = templates.at(mod);
+    templates.erase(mod);
+    return tmpl;
+  }
+
+  // Runs f(0) ... f(numTasks - 1) on up to numThreads threads, including
+  // the calling thread.
+  template<typename F>
+  static void parallelFor(const int numThreads, const int numTasks, F f) {
+    if ((numThreads <= 1) || (numTasks <= 1)) {
+      for (int i = 0; i < numTasks; i++) {
+        f(i);
+      }
+      return;
+    }
+
+    std::atomic<int> nextTask(0);
+    auto worker = [&nextTask, numTasks, &f]() {
+      int i;
+      while ((i = nextTask++) < numTasks) {
+        f(i);
+      }
+    };
+
+    vector<thread> workers;
+    for (int i = 1; i < std::min(numThreads, numTasks); i++) {
+      workers.push_back(thread(worker));
+    }
+    worker();
+
+    for (auto& t : workers) {
+      t.join();
+    }
+  }
+
+  EventSimulator::EventSimulator(CoreIR::Module* const mod_,
+                                 CoreIR::Instance* const instanceBeingSimulated_,
+                                 EventSimulator* const container_,
+                                 const ElaborationOptions& options) :
+    mod(mod_),
+    instanceBeingSimulated(instanceBeingSimulated_),
+    container(container_),
+    templates(nullptr),
+    tmpl(nullptr),
+    twoState(false),
+    foldingEnabled(options.foldConstants) {
+
+    assert(mod != nullptr);
+    assert(mod->hasDef());
+
+    stats = {0, 0, 0};
+    causality = nullptr;
+    batchTime = 0;
+    batchDelta = 0;
+    anyPresampled = false;
+
+    if (container == nullptr) {
+      templates = new ModuleTemplateCache(options.pruneDeadLogic,
+                                          options.aliasWires);
+      templates->build(mod);
+      maxLoopIterations = options.maxLoopIterations;
+    } else {
+      templates = container->templates;
+      foldingEnabled = container->foldingEnabled;
+      maxLoopIterations = container->maxLoopIterations;
+    }
+    tmpl = templates->get(mod);
+
+    auto def = mod->getDef();
+    CoreIR::Wireable* self = def->sel("self");
+
+    bool verbose = (container == nullptr) && logEnabled(LOG_LEVEL_DEBUG);
+
+    if (verbose) {
+      logMessage(LOG_LEVEL_DEBUG, "Initializing " + mod->getName());
+    }
+    // Add interface default values
+    values[self] = instantiateWireValue(tmpl->getDefaultValue(self));
+
+    const int numInstances = def->getInstances().size();
+    int numElaborated = 0;
+    vector<Instance*> definedInstances;
+    for (auto instR : def->getInstances()) {
+
+      values[instR.second] =
+        instantiateWireValue(tmpl->getDefaultValue(instR.second));
+
+      if (instR.second->getModuleRef()->hasDef()) {
+        definedInstances.push_back(instR.second);
+      } else {
+        numElaborated++;
+        if (options.progress) {
+          options.progress(ELABORATION_PHASE_VALUES,
+                           numElaborated,
+                           numInstances,
+                           instR.second);
+        }
+      }
+    }
+
+    for (auto& alias : tmpl->getAliases()) {
+      shareStorage(alias.first, getWireValue(alias.second));
+    }
+
+    resolvePortValues();
+    resolveRegisterGroups();
+    resolveSchedule();
+
+    // Each submodule simulator only writes its own storage, so the
+    // children of this module can be elaborated concurrently.
+    int numThreads = options.numThreads;
+    if (numThreads == 0) {
+      numThreads = std::max(1, (int) thread::hardware_concurrency());
+    }
+
+    vector<EventSimulator*> subSims(definedInstances.size(), nullptr);
+    mutex progressLock;
+    parallelFor(numThreads, definedInstances.size(), [&](const int i) {
+        Instance* inst = definedInstances[i];
+        subSims[i] = new EventSimulator(inst->getModuleRef(), inst, this);
+
+        if (options.progress) {
+          lock_guard<mutex> lock(progressLock);
+          numElaborated++;
+          options.progress(ELABORATION_PHASE_VALUES,
+                           numElaborated,
+                           numInstances,
+                           inst);
+        }
+      });
+
+    for (int i = 0; i < (int) definedInstances.size(); i++) {
+      submodules[definedInstances[i]] = subSims[i];
+    }
+    resolveClockFanOut();
+
+    initializeConstants(options.progress, verbose);
+  }
+
+  // Set default values for wires that are not initialized to x. All
+  // constants are set first and then propagated together.
+  void EventSimulator::initializeConstants(const ElaborationCallback& progress,
+                                           const bool verbose) {
+    auto& constants = tmpl->getConstantOrder([this]() {
+        return findConstants();
+      });
+
+    std::set<CoreIR::Wireable*> constantSet(begin(constants), end(constants));
+    std::set<CoreIR::Select*> freshSignals;
+    int numInstances = mod->getDef()->getInstances().size();
+    int numInitialized = 0;
+    for (auto inst : constants) {
+
+      if (verbose) {
+        logMessage(LOG_LEVEL_DEBUG,
+                   "Initializing constant # " + std::to_string(numInitialized) + ": " + inst->getInstname() + ", type = " + CoreIR::getQualifiedOpName(*inst));
+      }
+
+      OpCode op = tmpl->getOpCode(inst);
+      if ((op == OP_CONST) || (op == OP_BIT_CONST)) {
+        setConstantValue(inst);
+      } else {
+        bool folded = tryFoldInstance(inst, constantSet);
+        assert(folded);
+      }
+
+      for (auto selR : inst->getSelects()) {
+        if (selR.second->getType()->getDir() == Type::DK_Out) {
+          freshSignals.insert(selR.second);
+        }
+      }
+
+      numInitialized++;
+      if (progress) {
+        progress(ELABORATION_PHASE_CONSTANTS,
+                 numInitialized,
+                 numInstances,
+                 inst);
+      }
+    }
+
+    // Every other instance needs no initialization, but is still reported
+    // so that the phase covers each instance of the module once
+    if (progress) {
+      int numReported = numInitialized;
+      for (auto instR : mod->getDef()->getInstances()) {
+        if (!dbhc::elem<Wireable*>(instR.second, constantSet)) {
+          numReported++;
+          progress(ELABORATION_PHASE_CONSTANTS,
+                   numReported,
+                   numInstances,
+                   instR.second);
+        }
+      }
+    }
+
+    updateSignals(freshSignals);
+  }
+
+  // Points the storage slot of receiver in its parent value at storage
+  void EventSimulator::shareStorage(CoreIR::Select* const receiver,
+                                    WireValue* const storage) {
+    WireValue* parent = getWireValue(receiver->getParent());
+    const std::string& selStr = receiver->getSelStr();
+
+    assert(getWireValue(receiver)->getType() == storage->getType());
+
+    if (parent->getType() == WIRE_VALUE_RECORD) {
+      static_cast<RecordValue*>(parent)->setFieldValue(selStr, storage);
+    } else {
+      assert(parent->getType() == WIRE_VALUE_ARRAY);
+      static_cast<ArrayValue*>(parent)->setElem(std::stoi(selStr), storage);
+    }
+  }
+
+  // Storage is never moved after wires are aliased, so it is safe to keep
+  // pointers into it
+  void EventSimulator::resolvePortValues() {
+    auto& paths = tmpl->getSelectPaths();
+    selectValues.resize(paths.size());
+    for (int i = 0; i < (int) paths.size(); i++) {
+      WireValue* value = values.at(paths[i].first);
+      for (int index : paths[i].second) {
+        if (value->getType() == WIRE_VALUE_RECORD) {
+          value = static_cast<RecordValue*>(value)->getFields()[index].second;
+        } else {
+          value = static_cast<ArrayValue*>(value)->elemMutable(index);
+        }
+      }
+      selectValues[i] = value;
+    }
+
+    const auto& instances = mod->getDef()->getInstances();
+    portValues.resize(instances.size());
+
+    for (auto instR : instances) {
+      Instance* inst = instR.second;
+      const InstanceInfo& info = tmpl->getInstanceInfo(inst);
+
+      PortValues& ports = portValues[info.index];
+      ports.in0 = portValue(info.in0);
+      ports.in1 = portValue(info.in1);
+      ports.in = portValue(info.in);
+      ports.sel = portValue(info.sel);
+      ports.clk = portValue(info.clk);
+      ports.arst = portValue(info.arst);
+      ports.out = portValue(info.out);
+
+      ports.init = nullptr;
+      if (info.op == OP_REG_ARST) {
+        ports.init = instantiateWireValue(ports.out);
+
+        // Symbolic init values are bound by the instance this simulator
+        // is simulating
+        Instance* initSource = inst;
+        if (info.params.symbolicInit) {
+          initSource = getInstanceBeingSimulated();
+          assert(initSource != nullptr);
+        }
+        setWireBitVector(initSource->getModArgs().at("init")->get<BitVector>(),
+                         *ports.init);
+      }
+
+      ports.copies.clear();
+      ports.inCopies.clear();
+      for (auto& conn : tmpl->getCopiedConnections(inst)) {
+        ports.copies.push_back({getWireValue(conn.second),
+              getWireValue(conn.first)});
+        if (topPort(cast<Select>(conn.second))->getSelStr() == "in") {
+          ports.inCopies.push_back(ports.copies.back());
+        }
+      }
+    }
+  }
+
+  void EventSimulator::resolveRegisterGroups() {
+    auto& groups = tmpl->getRegisterGroups();
+    registerGroupStates.resize(groups.size());
+
+    for (int i = 0; i < (int) groups.size(); i++) {
+      RegisterGroupState& state = registerGroupStates[i];
+      state.clock = bitAt(getWireValue(groups[i].clock), 0);
+      state.lastClock = state.clock->value();
+      state.presampled = false;
+
+      state.sampled.clear();
+      for (auto reg : groups[i].registers) {
+        const InstanceInfo& info = tmpl->getInstanceInfo(reg);
+        state.sampled.push_back(instantiateWireValue(portValues[info.index].out));
+      }
+    }
+  }
+
+  void EventSimulator::resolveSchedule() {
+    nodeQueue.resize(tmpl->getNumRanks(), mod->getDef()->getInstances().size());
+
+    int numLoops = tmpl->getLoops().size();
+    loopEvaluations.assign(numLoops, 0);
+    activeLoops.clear();
+    oscillating.assign(numLoops, false);
+
+    if (causality != nullptr) {
+      queuedBy.assign(mod->getDef()->getInstances().size(), nullptr);
+    }
+  }
+
+  // Every register that sees an edge samples its input before any
+  // register output changes, so registers clocked together always see
+  // each other's old values
+  void EventSimulator::sampleGroup(const int group) {
+    auto& registers = tmpl->getRegisterGroups()[group].registers;
+    auto& sampled = registerGroupStates[group].sampled;
+    for (int i = 0; i < (int) registers.size(); i++) {
+      if (isSkipped(registers[i])) {
+        continue;
+      }
+
+      // Only in is copied, so that registers with an async reset still
+      // see the old reset value when they are evaluated
+      PortValues& ports = portValues[tmpl->getInstanceInfo(registers[i]).index];
+      for (auto& copy : ports.inCopies) {
+        copyWireValueOver(copy.first, copy.second);
+      }
+      copyWireValueOver(sampled[i], ports.in);
+    }
+  }
+
+  // Finds the ports of submodules that feed a register clock in them or
+  // further down. Submodules must be resolved first.
+  void EventSimulator::resolveClockFanOut() {
+    auto& portSels = tmpl->getPortSelects();
+
+    clockFanOut.clear();
+    for (auto& fanOut : tmpl->getAllEventReceivers()) {
+      if (!isa<Select>(fanOut.first)) {
+        continue;
+      }
+
+      for (auto receiver : fanOut.second) {
+        Wireable* top = receiver->getTopParent();
+        if (!isa<Instance>(top) ||
+            !contains_key(cast<Instance>(top), submodules)) {
+          continue;
+        }
+
+        EventSimulator* sim = submodules.at(cast<Instance>(top));
+        auto& subPorts = sim->tmpl->getPortSelects();
+        string portName = topPort(receiver)->getSelStr();
+        for (int i = 0; i < (int) subPorts.size(); i++) {
+          if ((subPorts[i]->getSelStr() == portName) && sim->clockInputs[i]) {
+            clockFanOut[cast<Select>(fanOut.first)].push_back({sim, i});
+          }
+        }
+      }
+    }
+
+    clockInputs.assign(portSels.size(), false);
+    for (int i = 0; i < (int) portSels.size(); i++) {
+      clockInputs[i] = (tmpl->getClockedGroups(portSels[i]) != nullptr);
+    }
+    for (auto& targets : clockFanOut) {
+      Select* port = topPort(targets.first);
+      for (int i = 0; i < (int) portSels.size(); i++) {
+        if (portSels[i] == port) {
+          clockInputs[i] = true;
+        }
+      }
+    }
+  }
+
+  // Samples the registers clocked by port here and in submodules while
+  // every register input still holds its value from before the edge.
+  // Groups that see no edge discard the sample in clockRegisters.
+  void EventSimulator::presampleClockInput(const int port) {
+    Select* sel = tmpl->getPortSelects()[port];
+    anyPresampled = true;
+
+    auto clocked = tmpl->getClockedGroups(sel);
+    if (clocked != nullptr) {
+      for (int g : *clocked) {
+        sampleGroup(g);
+        registerGroupStates[g].presampled = true;
+      }
+    }
+
+    presampleSubmodules(sel);
+  }
+
+  void EventSimulator::presampleSubmodules(CoreIR::Select* const signal) {
+    auto targets = clockFanOut.find(signal);
+    if (targets == std::end(clockFanOut)) {
+      return;
+    }
+
+    for (auto& target : targets->second) {
+      if (!isSkipped(target.first->instanceBeingSimulated)) {
+        target.first->presampleClockInput(target.second);
+      }
+    }
+  }
+
+  // Drops samples that were taken for a clock change that never reached
+  // the registers, for example because only other bits of the port moved
+  void EventSimulator::clearPresampled() {
+    if (!anyPresampled) {
+      return;
+    }
+    anyPresampled = false;
+
+    for (auto& state : registerGroupStates) {
+      state.presampled = false;
+    }
+    for (auto sub : submodules) {
+      sub.second->clearPresampled();
+    }
+  }
+
+  void EventSimulator::clockRegisters(const std::vector<int>& groups,
+                                      SignalQueue& freshSignals) {
+    auto& allGroups = tmpl->getRegisterGroups();
+
+    edgeGroups.clear();
+    for (int g : groups) {
+      RegisterGroupState& state = registerGroupStates[g];
+      bsim::quad_value oldClk = state.lastClock;
+      bsim::quad_value clk = state.clock->value();
+      state.lastClock = clk;
+
+      // TODO: Add x considerations
+      bool posedge = (clk == 1) && (oldClk == 0);
+      bool negedge = (clk == 0) && (oldClk == 1);
+
+      if ((allGroups[g].posedge && posedge) ||
+          (!allGroups[g].posedge && negedge)) {
+        edgeGroups.push_back(g);
+      }
+    }
+
+    for (int g : edgeGroups) {
+      if (!registerGroupStates[g].presampled) {
+        sampleGroup(g);
+      }
+    }
+
+    for (int g : groups) {
+      registerGroupStates[g].presampled = false;
+    }
+
+    for (int g : edgeGroups) {
+      auto& registers = allGroups[g].registers;
+      auto& sampled = registerGroupStates[g].sampled;
+      for (int i = 0; i < (int) registers.size(); i++) {
+        if (isSkipped(registers[i])) {
+          continue;
+        }
+
+        const InstanceInfo& info = tmpl->getInstanceInfo(registers[i]);
+        ChangeMask changed =
+          updateWireValue(portValues[info.index].out, sampled[i]);
+        if (changed != 0) {
+          freshSignals.push(info.out, changed);
+          recordChange(info.out, registers[i], allGroups[g].clock);
+        }
+      }
+    }
+  }
+
+  void EventSimulator::setConstantValue(CoreIR::Instance* const inst) {
+    if (tmpl->getOpCode(inst) == OP_BIT_CONST) {
+      bool value = inst->getModArgs().at("value")->get<bool>();
+      setValueNoUpdate(inst->sel("out"), CoreIR::BitVec(1, value));
+    } else {
+      assert(tmpl->getOpCode(inst) == OP_CONST);
+
+      BitVector value =
+        inst->getModArgs().at("value")->get<BitVector>();
+      setValueNoUpdate(inst->sel("out"), value);
+    }
+  }
+
+  // True if every connection into port of node is driven by a constant,
+  // which is either a constant node or a constant port of a node.
+  // Undriven bits stay x forever, so they count as constant as well.
+  bool EventSimulator::portIsConstant(CoreIR::Wireable* const node,
+                                      const std::string& port,
+                                      const std::set<CoreIR::Wireable*>& constants) {
+    for (auto& conn : allSourceConnections(node)) {
+      if ((port != "") && (topPort(conn.second)->getSelStr() != port)) {
+        continue;
+      }
+
+      if (!dbhc::elem(conn.first->getTopParent(), constants) &&
+          !dbhc::elem<Wireable*>(topPort(conn.first), constants)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Evaluates inst if its output is a function of constants only: all
+  // of its inputs are constant, it is a mux whose select and selected
+  // input are constant, or it is an and / or with a constant input of all
+  // zeros / all ones.
+  bool EventSimulator::tryFoldInstance(CoreIR::Instance* const inst,
+                                       const std::set<CoreIR::Wireable*>& constants) {
+    OpCode op = tmpl->getOpCode(inst);
+    if ((op == OP_SUBMODULE) || (op == OP_REG) || (op == OP_REG_ARST) ||
+        (op == OP_TERM) || (op == OP_UNIMPLEMENTED) ||
+        (op == OP_UNSUPPORTED) || (op == OP_CONST) || (op == OP_BIT_CONST)) {
+      return false;
+    }
+
+    if (portIsConstant(inst, "", constants)) {
+      updateInstance(inst);
+      return true;
+    }
+
+    if (op == OP_MUX) {
+      if (!portIsConstant(inst, "sel", constants)) {
+        return false;
+      }
+
+      updateInputs(inst);
+
+      uint64_t sel = 0;
+      readKnownWord(*getWireValue(inst->sel("sel")), sel);
+
+      if (!portIsConstant(inst, sel == 0 ? "in0" : "in1", constants)) {
+        return false;
+      }
+
+      updateInstance(inst);
+      return true;
+    }
+
+    if ((op == OP_AND) || (op == OP_OR)) {
+      updateInputs(inst);
+
+      for (auto port : {"in0", "in1"}) {
+        if (!portIsConstant(inst, port, constants)) {
+          continue;
+        }
+
+        WireValue* in = getWireValue(inst->sel(port));
+        uint64_t word;
+        if ((bitWidth(*in) > 64) || !readKnownWord(*in, word)) {
+          continue;
+        }
+
+        uint64_t ones = bitWidth(*in) == 64 ? ~((uint64_t) 0) :
+          ((((uint64_t) 1) << bitWidth(*in)) - 1);
+
+        if ((op == OP_AND) && (word == 0)) {
+          writeWord(0, *getWireValue(inst->sel("out")));
+          return true;
+        }
+
+        if ((op == OP_OR) && (word == ones)) {
+          writeWord(ones, *getWireValue(inst->sel("out")));
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  std::vector<CoreIR::Instance*> EventSimulator::findConstants() {
+    vector<Instance*> order;
+    std::set<Wireable*> constants;
+
+    std::deque<Instance*> toCheck;
+    for (auto instR : mod->getDef()->getInstances()) {
+      Instance* inst = instR.second;
+      OpCode op = tmpl->getOpCode(inst);
+      if ((op == OP_CONST) || (op == OP_BIT_CONST)) {
+        setConstantValue(inst);
+        order.push_back(inst);
+        constants.insert(inst);
+      }
+
+      toCheck.push_back(inst);
+    }
+
+    if (!foldingEnabled) {
+      return order;
+    }
+
+    while (toCheck.size() > 0) {
+      Instance* inst = toCheck.front();
+      toCheck.pop_front();
+
+      if (dbhc::elem<Wireable*>(inst, constants) ||
+          !tryFoldInstance(inst, constants)) {
+        continue;
+      }
+
+      order.push_back(inst);
+      constants.insert(inst);
+
+      for (auto selR : inst->getSelects()) {
+        if (selR.second->getType()->getDir() != Type::DK_Out) {
+          continue;
+        }
+
+        for (auto receiver : allReceiverSelects(selR.second)) {
+          Wireable* top = receiver->getTopParent();
+          if (isa<Instance>(top)) {
+            toCheck.push_back(cast<Instance>(top));
+          }
+        }
+      }
+    }
+
+    return order;
+  }
+
+  WireValue* EventSimulator::instantiateWireValue(const WireValue* const proto) {
+    WireValue* val = nullptr;
+
+    if (proto->getType() == WIRE_VALUE_RECORD) {
+      const RecordValue* const r = static_cast<const RecordValue* const>(proto);
+
+      std::vector<std::pair<std::string, WireValue*> > fields;
+      for (auto& field : r->getFields()) {
+        fields.push_back({field.first, instantiateWireValue(field.second)});
+      }
+      val = new RecordValue(fields);
+
+    } else if (proto->getType() == WIRE_VALUE_ARRAY) {
+      const ArrayValue* const arr = static_cast<const ArrayValue* const>(proto);
+
+      std::vector<WireValue*> elems;
+      for (int i = 0; i < arr->length(); i++) {
+        elems.push_back(instantiateWireValue(arr->elem(i)));
+      }
+      val = new ArrayValue(elems);
+
+    } else {
+      assert(proto->getType() == WIRE_VALUE_BIT);
+
+      const BitValue* const b = static_cast<const BitValue* const>(proto);
+      val = new BitValue(b->value());
+    }
+
+    wireValues.push_back(val);
+
+    return val;
+  }
+
+  void EventSimulator::updateSignals(std::set<CoreIR::Select*>& freshSignals) {
+    SignalQueue signals;
+    for (auto sel : freshSignals) {
+      signals.push(sel, ALL_BITS_CHANGED);
+    }
+    freshSignals.clear();
+
+    updateSignals(signals);
+  }
+
+  // Names the instances of a loop in a stable order
+  static std::string loopName(const std::vector<CoreIR::Instance*>& loop,
+                              const std::string& prefix) {
+    vector<string> names;
+    for (auto inst : loop) {
+      names.push_back(prefix + inst->getInstname());
+    }
+    std::sort(begin(names), end(names));
+
+    string name = names[0];
+    for (int i = 1; i < (int) names.size(); i++) {
+      name += ", " + names[i];
+    }
+    return name;
+  }
+
+  // Signals are propagated to their receivers as soon as they change, but
+  // instances wait in nodeQueue until every instance of a lower rank has
+  // been evaluated. Only instances of one combinational loop can be
+  // evaluated more than once per call.
+  void EventSimulator::updateSignals(SignalQueue& freshSignals) {
+
+    while (!freshSignals.empty() || !nodeQueue.empty()) {
+
+      while (!freshSignals.empty()) {
+        auto next = freshSignals.pop();
+        stats.signalsProcessed++;
+
+        //cout << "Updates from " << next.first->toString() << endl;
+
+        if (clockFanOut.size() > 0) {
+          presampleSubmodules(next.first);
+        }
+
+        auto clocked = tmpl->getClockedGroups(next.first);
+        if (clocked != nullptr) {
+          clockRegisters(*clocked, freshSignals);
+        }
+
+        // Only receivers that read one of the changed bits need updating
+        auto& receiverSels = tmpl->getEventReceivers(next.first);
+        auto& consumed = tmpl->getConsumedBits(next.first);
+        bool selfUpdated = false;
+        for (int i = 0; i < (int) receiverSels.size(); i++) {
+          Select* rSel = receiverSels[i];
+          Wireable* top = rSel->getTopParent();
+
+          if (((consumed[i] & next.second) == 0) ||
+              isSkipped(top) ||
+              dbhc::elem(rSel, ignoredReceivers)) {
+            continue;
+          }
+
+          // Assumes no inout ports
+          if (!isa<Instance>(top)) {
+            if (!selfUpdated) {
+              updateInputs(top);
+              selfUpdated = true;
+            }
+            continue;
+          }
+
+          const InstanceInfo& info = tmpl->getInstanceInfo(cast<Instance>(top));
+          nodeQueue.push(cast<Instance>(top), info.rank, info.index);
+          if (causality != nullptr) {
+            queuedBy[info.index] = next.first;
+          }
+        }
+      }
+
+      if (nodeQueue.empty()) {
+        break;
+      }
+
+      Instance* inst = nodeQueue.pop();
+
+      int loop = tmpl->getLoopOfRank(tmpl->getInstanceInfo(inst).rank);
+      if ((loop >= 0) && !withinLoopBound(loop)) {
+        continue;
+      }
+
+      stats.nodesEvaluated++;
+      batchDelta++;
+
+      ChangeMask changed = updateInstance(inst);
+      if (changed == 0) {
+        continue;
+      }
+
+      // Add new signals to the fresh queue
+      scheduleOutputs(inst, changed, freshSignals);
+    }
+
+    for (auto loop : activeLoops) {
+      loopEvaluations[loop] = 0;
+    }
+    activeLoops.clear();
+
+    batchTime++;
+    batchDelta = 0;
+  }
+
+  bool EventSimulator::withinLoopBound(const int loop) {
+    if (loopEvaluations[loop] == 0) {
+      activeLoops.push_back(loop);
+    }
+    loopEvaluations[loop]++;
+
+    int loopSize = tmpl->getLoops()[loop].size();
+    if (loopEvaluations[loop] <= maxLoopIterations * loopSize) {
+      return true;
+    }
+
+    if (!oscillating[loop]) {
+      oscillating[loop] = true;
+
+      if (logEnabled(LOG_LEVEL_WARNING)) {
+        logMessage(LOG_LEVEL_WARNING,
+                   "WARNING: Combinational loop in " + mod->getName() +
+                   " did not settle: " + loopName(tmpl->getLoops()[loop], ""));
+      }
+    }
+
+    return false;
+  }
+
+  void EventSimulator::scheduleOutputs(CoreIR::Instance* const inst,
+                                       const ChangeMask changed,
+                                       SignalQueue& freshSignals) {
+    const InstanceInfo& info = tmpl->getInstanceInfo(inst);
+    Select* causeInput =
+      causality == nullptr ? nullptr : queuedBy[info.index];
+
+    if (info.op == OP_SUBMODULE) {
+      assert(outputChanges.size() == info.outputs.size());
+
+      for (int i = 0; i < (int) info.outputs.size(); i++) {
+        if (outputChanges[i] != 0) {
+          freshSignals.push(info.outputs[i], outputChanges[i]);
+          stats.outputsScheduled++;
+          recordChange(info.outputs[i], inst, causeInput);
+        }
+      }
+      return;
+    }
+
+    for (auto out : info.outputs) {
+      freshSignals.push(out, changed);
+      stats.outputsScheduled++;
+      recordChange(out, inst, causeInput);
+    }
+  }
+
+  void EventSimulator::recordChange(CoreIR::Select* const net,
+                                    CoreIR::Instance* const cause,
+                                    CoreIR::Select* const causeInput) {
+    if (causality == nullptr) {
+      return;
+    }
+
+    const WireValue* value = getWireValue(net);
+
+    CausalityEvent event{batchTime, batchDelta, net, 0, 0, cause, causeInput};
+    int width = std::min(bitWidth(*value), 64);
+    for (int i = 0; i < width; i++) {
+      bsim::quad_value b = bitAt(const_cast<WireValue*>(value), i)->value();
+      if (b.is_binary()) {
+        event.value |= ((uint64_t) b.binary_value()) << i;
+      } else {
+        event.unknown |= ((uint64_t) 1) << i;
+      }
+    }
+
+    causality->record(event);
+  }
+
+  void EventSimulator::enableCausalityLog(const size_t capacity) {
+    delete causality;
+    causality = new CausalityLog(capacity);
+    queuedBy.assign(mod->getDef()->getInstances().size(), nullptr);
+
+    for (auto sub : submodules) {
+      sub.second->enableCausalityLog(capacity);
+    }
+  }
+
+  void EventSimulator::disableCausalityLog() {
+    delete causality;
+    causality = nullptr;
+
+    for (auto sub : submodules) {
+      sub.second->disableCausalityLog();
+    }
+  }
+
+  std::vector<CausalityStep>
+  EventSimulator::explain(const std::string& name) const {
+    CoreIR::SelectPath paths = CoreIR::splitString<CoreIR::SelectPath>(name, '$');
+    assert(paths.size() >= 1);
+
+    const EventSimulator* sim = this;
+    for (int i = 0; i < ((int) paths.size()) - 1; i++) {
+      auto subInstance = sim->mod->getDef()->getInstances().at(paths[i]);
+      assert(contains_key(subInstance, sim->submodules));
+      sim = sim->submodules.at(subInstance);
+    }
+
+    vector<CausalityStep> steps;
+    if (sim->causality == nullptr) {
+      return steps;
+    }
+
+    assert(sim->mod->getDef()->canSel(paths.back()));
+    Select* net = cast<Select>(sim->mod->getDef()->sel(paths.back()));
+
+    // Receivers hold no events of their own, so start from the driver
+    // of the net
+    const CausalityLog& log = *(sim->causality);
+    int eventIndex = log.findLatest(net, log.size());
+    if (eventIndex < 0) {
+      for (auto& conn : getSourceConnections(net->getTopParent())) {
+        if ((conn.second == net) && isa<Select>(conn.first)) {
+          eventIndex = log.findLatest(cast<Select>(conn.first), log.size());
+        }
+      }
+    }
+
+    while (eventIndex >= 0) {
+      const CausalityEvent& event = log.at(eventIndex);
+
+      CausalityStep step{event.net->toString(), event.time, event.delta,
+          event.value, event.unknown, "", false};
+      if (event.cause != nullptr) {
+        step.cause = event.cause->getInstname();
+        OpCode op = sim->tmpl->getOpCode(event.cause);
+        step.causeIsRegister = (op == OP_REG) || (op == OP_REG_ARST);
+      }
+      steps.push_back(step);
+
+      if ((event.causeInput == nullptr) || step.causeIsRegister) {
+        break;
+      }
+
+      eventIndex = log.findLatest(event.causeInput, eventIndex);
+    }
+
+    return steps;
+  }
+
+  EventStats EventSimulator::getEventStats() const {
+    EventStats total = stats;
+    for (auto& sub : submodules) {
+      EventStats subStats = sub.second->getEventStats();
+      total.signalsProcessed += subStats.signalsProcessed;
+      total.nodesEvaluated += subStats.nodesEvaluated;
+      total.outputsScheduled += subStats.outputsScheduled;
+    }
+    return total;
+  }
+
+  void EventSimulator::resetEventStats() {
+    stats = {0, 0, 0};
+    for (auto& sub : submodules) {
+      sub.second->resetEventStats();
+    }
+  }
+
+  void EventSimulator::updateInputs(CoreIR::Wireable* const inst) {
+    if (isa<Instance>(inst)) {
+      const InstanceInfo& info = tmpl->getInstanceInfo(cast<Instance>(inst));
+      updateInputs(portValues[info.index]);
+      return;
+    }
+
+    // Set the values on all instance selects?
+    //cout << "Updating " << inst->toString() << endl;
+
+    // More than 20% of the time in larger simulations is spent here.
+    for (auto& conn : tmpl->getCopiedConnections(inst)) {
+      //cout << "\t" << conn.first->toString() << " <-> " << conn.second->toString() << endl;
+      Wireable* driver = conn.first;
+      Wireable* receiver = conn.second;
+      WireValue* driverValue = getWireValue(driver);
+      setValueNoUpdate(receiver, driverValue);
+    }
+  }
+
+  ChangeMask EventSimulator::updateInstance(CoreIR::Instance* const inst) {
+    const InstanceInfo& info = tmpl->getInstanceInfo(inst);
+    PortValues& ports = portValues[info.index];
+
+    switch (info.op) {
+    case OP_ANDR: {
+      updateInputs(ports);
+
+      WireValue* in = ports.in;
+      int width = bitWidth(*in);
+
+      bsim::quad_value res(1);
+      for (int i = 0; i < width; i++) {
+        if (bitAt(in, i)->value() != bsim::quad_value(1)) {
+          res = bsim::quad_value(0);
+          break;
+        }
+      }
+
+      return setBit(bitAt(ports.out, 0), res) ? changedBit(0) : 0;
+    }
+    case OP_MUX: {
+
+      updateInputs(ports);
+
+      // Always pick input 0 for unknown values. Could select a random
+      // value if we wanted to
+      uint64_t sel = 0;
+      readKnownWord(*ports.sel, sel);
+
+      const WireValue* chosen = sel == 0 ? ports.in0 : ports.in1;
+
+      return updateWireValue(ports.out, chosen);
+    }
+    case OP_SLICE: {
+      uint lo = info.params.lo;
+      uint hi = info.params.hi;
+
+      updateInputs(ports);
+
+      WireValue* in = ports.in;
+      WireValue* out = ports.out;
+
+      ChangeMask changed = 0;
+      for (uint i = lo; i < hi; i++) {
+        if (setBit(bitAt(out, i - lo), bitAt(in, i)->value())) {
+          changed |= changedBit(i - lo);
+        }
+      }
+
+      return changed;
+    }
+    case OP_TERM: {
+      return 0;
+    }
+    case OP_SUBMODULE: {
+
+      updateInputs(ports);
+
+      EventSimulator* sim = submodules[inst];
+
+      // Only copy inputs in and outputs out, since either side may share
+      // the storage of its ports with the logic that drives them. Only
+      // the inputs that changed are scheduled inside the submodule.
+      auto& dirs = sim->tmpl->getPortDirections();
+      auto& selfSels = sim->tmpl->getPortSelects();
+      auto& instPorts =
+        static_cast<RecordValue*>(getWireValue(inst))->getFields();
+      auto& selfPorts =
+        static_cast<RecordValue*>(sim->getSelfValue())->getFields();
+
+      SignalQueue freshSignals;
+      for (int i = 0; i < (int) dirs.size(); i++) {
+        if (dirs[i] != Type::DK_Out) {
+          ChangeMask changed =
+            updateWireValue(selfPorts[i].second, instPorts[i].second);
+          if (changed != 0) {
+            freshSignals.push(selfSels[i], changed);
+          }
+        }
+      }
+      sim->updateSignals(freshSignals);
+      sim->clearPresampled();
+
+      // Record which outputs moved so that scheduleOutputs only pushes
+      // those
+      outputChanges.clear();
+      ChangeMask anyChanged = 0;
+      for (int i = 0; i < (int) dirs.size(); i++) {
+        if (dirs[i] == Type::DK_In) {
+          continue;
+        }
+
+        ChangeMask changed =
+          updateWireValue(instPorts[i].second, selfPorts[i].second);
+        if (dirs[i] == Type::DK_Out) {
+          outputChanges.push_back(changed);
+        }
+        anyChanged |= changed;
+      }
+
+      return anyChanged;
+    }
+    case OP_REG: {
+
+      // Clock edges are handled for the whole register group by
+      // clockRegisters
+      updateInputs(ports);
+
+      return 0;
+    }
+    case OP_WRAP: {
+
+      // Assuming no wrapping of record or array of array types for now.
+      // Only existing named types are clk and reset
+      return updateUnopNode(ports, [](const BitVec& l) {
+          return l;
+        }, [](const uint64_t l, const int width) {
+          return l;
+        });
+    }
+    case OP_REG_ARST: {
+
+      // Clock edges are handled by clockRegisters, which runs before any
+      // receiver of the clock, so a reset on the same event still wins
+      BitValue* rstBit = bitAt(ports.arst, 0);
+      bsim::quad_value oldRst = rstBit->value();
+      
+      updateInputs(ports);
+
+      bsim::quad_value rst = rstBit->value();
+
+      bool resetOnPosedge = info.params.arstPosedge;
+      
+      // TODO: Add x considerations
+      bool posedgeRst = (rst == 1) && (oldRst == 0);
+      bool negedgeRst = (rst == 0) && (oldRst == 1);
+
+      WireValue* out = ports.out;
+
+      // Reset has priority over clock
+      if ((resetOnPosedge && posedgeRst) || (!resetOnPosedge && negedgeRst)) {
+        return updateWireValue(out, ports.init);
+      }
+
+      return 0;
+    }
+    case OP_ZEXT: {
+
+      uint inWidth = info.params.widthIn;
+      uint outWidth = info.params.widthOut;
+
+      updateInputs(ports);
+
+      WireValue* in = ports.in;
+      WireValue* out = ports.out;
+
+      assert(((uint) bitWidth(*in)) == inWidth);
+
+      ChangeMask changed = 0;
+      for (uint i = 0; i < inWidth; i++) {
+        if (setBit(bitAt(out, i), bitAt(in, i)->value())) {
+          changed |= changedBit(i);
+        }
+      }
+      for (uint i = inWidth; i < outWidth; i++) {
+        if (setBit(bitAt(out, i), bsim::quad_value(0))) {
+          changed |= changedBit(i);
+        }
+      }
+
+      return changed;
+    }
+    case OP_EQ: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return BitVec(1, l == r);
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return (uint64_t) (l == r);
+        });
+    }
+    case OP_AND: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return l & r;
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return l & r;
+        });
+    }
+    case OP_OR: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return l | r;
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return l | r;
+        });
+    }
+    case OP_XOR: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return l ^ r;
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return l ^ r;
+        });
+    }
+    case OP_SHL: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return bsim::shl(l, r);
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return r >= 64 ? 0 : l << r;
+        });
+    }
+    case OP_ASHR: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return bsim::ashr(l, r);
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return ashrWord(l, r, width);
+        });
+    }
+    case OP_LSHR: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return bsim::lshr(l, r);
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return r >= 64 ? 0 : l >> r;
+        });
+    }
+    case OP_SUB: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return bsim::sub_general_width_bv(l, r);
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return l - r;
+        });
+    }
+    case OP_MUL: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return bsim::mul_general_width_bv(l, r);
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return l * r;
+        });
+    }
+    case OP_ADD: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return bsim::add_general_width_bv(l, r);
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return l + r;
+        });
+    }
+    case OP_NEQ: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return BitVec(1, l != r);
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return (uint64_t) (l != r);
+        });
+    }
+    case OP_ULT: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return BitVec(1, l < r);
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return (uint64_t) (l < r);
+        });
+    }
+    case OP_ULE: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return BitVec(1, !(l > r));
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return (uint64_t) (l <= r);
+        });
+    }
+    case OP_UGE: {
+
+      return updateBinopNode(ports, [](const BitVec& l, const BitVec& r) {
+          return BitVec(1, l >= r);
+        }, [](const uint64_t l, const uint64_t r, const int width) {
+          return (uint64_t) (l >= r);
+        });
+    }
+    case OP_NOT: {
+
+      return updateUnopNode(ports, [](const BitVec& a) {
+          return ~a;
+        }, [](const uint64_t a, const int width) {
+          return ~a;
+        });
+    }
+    case OP_UNIMPLEMENTED: {
+      // TODO: FIX THIS WITH REAL MEM IMPLEMENTATION!!!
+
+      return 0;
+    }
+    case OP_ORR: {
+
+      return updateUnopNode(ports, [](const BitVec& sB) {
+          BitVec res(1, 0);
+          for (int i = 0; i < sB.bitLength(); i++) {
+            if (sB.get(i) == 1) {
+              res = BitVec(1, 1);
+              break;
+            }
+          }
+
+          return res;
+        }, [](const uint64_t a, const int width) {
+          return (uint64_t) (a != 0);
+        });
+    }
+    default:
+      cout << "ERROR: Unsupported operation " << getQualifiedOpName(*inst) << endl;
+      assert(false);
+    }
+
+    return 0;
+  }
+
+  std::map<CoreIR::Select*, CoreIR::BitVec>
+  EventSimulator::outputBitVecs(CoreIR::Wireable* const inst) {
+    map<Select*, BitVec> outMap;
+    for (auto selR : inst->getSelects()) {
+      Select* sel = selR.second;
+      if (sel->getType()->getDir() == Type::DirKind::DK_Out) {
+
+        if (isBitType(*(sel->getType())) ||
+            isBitArray(*(sel->getType()))) {
+          outMap.insert({sel, getBitVec(sel)});
+        } else {
+          for (auto sBp : outputBitVecs(sel)) {
+            outMap.insert(sBp);
+          }
+        }
+      }
+    }
+    return outMap;
+  }
+
+  static std::vector<std::string>
+  coneNames(const ModuleTemplate& tmpl, const IntervalList& cone) {
+    vector<string> names;
+    for (auto node : tmpl.coneMembers(cone)) {
+      names.push_back(isa<Instance>(node) ?
+                      cast<Instance>(node)->getInstname() : "self");
+    }
+    std::sort(begin(names), end(names));
+    return names;
+  }
+
+  // Cones stop at the interface, so the cone of one of its ports is built
+  // from the nodes connected to that port
+  static IntervalList portCone(const ModuleTemplate& tmpl,
+                               const std::vector<CoreIR::Select*>& neighbors,
+                               const bool drivers) {
+    IntervalList cone;
+    for (auto neighbor : neighbors) {
+      Wireable* node = neighbor->getTopParent();
+      int id = tmpl.getConeId(node);
+      cone.push_back({id, id + 1});
+      concat(cone, drivers ? tmpl.getDriverCone(node) : tmpl.getLoadCone(node));
+    }
+    return coalesce(cone);
+  }
+
+  std::vector<std::string>
+  EventSimulator::transitiveDrivers(const std::string& name) const {
+    assert(mod->getDef()->canSel(name));
+    Wireable* w = mod->getDef()->sel(name);
+    Wireable* top = w->getTopParent();
+    if (top != mod->getDef()->sel("self")) {
+      return coneNames(*tmpl, tmpl->getDriverCone(top));
+    }
+    return coneNames(*tmpl, portCone(*tmpl, getSourceSelects(w), true));
+  }
+
+  std::vector<std::string>
+  EventSimulator::transitiveLoads(const std::string& name) const {
+    assert(mod->getDef()->canSel(name));
+    Wireable* w = mod->getDef()->sel(name);
+    Wireable* top = w->getTopParent();
+    if (top != mod->getDef()->sel("self")) {
+      return coneNames(*tmpl, tmpl->getLoadCone(top));
+    }
+    return coneNames(*tmpl, portCone(*tmpl, getReceiverSelects(w), false));
+  }
+
+  // The selects of the interface and of instances with no fan-in that w
+  // depends on, read off the cone index of the template. Only the direct
+  // drivers of w are looked up in the CoreIR graph, so w may be a select.
+  std::set<CoreIR::Select*>
+  EventSimulator::sourceDrivers(CoreIR::Wireable* const w) {
+    Wireable* self = mod->getDef()->sel("self");
+
+    set<Select*> srcs;
+    for (auto next : getSourceSelects(w)) {
+      Wireable* top = next->getTopParent();
+      if ((top == self) || (tmpl->getFanIn(top).size() == 0)) {
+        srcs.insert(next);
+        continue;
+      }
+
+      for (auto driver : tmpl->getLeafDrivers(top)) {
+        srcs.insert(driver);
+      }
+      for (auto node : tmpl->coneMembers(tmpl->getDriverCone(top))) {
+        if (node != self) {
+          for (auto driver : tmpl->getLeafDrivers(node)) {
+            srcs.insert(driver);
+          }
+        }
+      }
+    }
+    
+    return srcs;
+  }
+
+  // Q: What kinds of facilities would be useful for hardware debugging?
+  // A: Displaying the calculation that lead to a given value?
+  //    Thm prover based suggestions about what would make a given port have its expected value
+
+  void EventSimulator::printInstances(const std::string& instanceName) {
+    for (auto instanceR : mod->getDef()->getInstances()) {
+      auto inst = instanceR.second;
+      if (getQualifiedOpName(*inst) == instanceName) {
+        cout << "\t" << inst->toString() << " = " << *getWireValue(inst) << endl;
+      }
+    }
+
+
+    for (auto subMod : submodules) {
+      cout << "In submodule " << subMod.first->toString() << endl;
+      subMod.second->printInstances(instanceName);
+    }
+  }
+
+  void EventSimulator::setValues(const std::vector<std::pair<std::string, CoreIR::BitVec> >& values) {
+    SignalQueue freshSignals;
+    for (auto signal : values) {
+
+      auto name = signal.first;
+      assert(mod->getDef()->canSel(name));
+      CoreIR::Wireable* s = mod->getDef()->sel(name);
+
+      assert(CoreIR::isa<CoreIR::Select>(s));
+
+      CoreIR::Select* sel = CoreIR::cast<CoreIR::Select>(s);
+      
+      ChangeMask changed = setInputNoUpdate(sel, signal.second);
+      if (changed != 0) {
+        freshSignals.push(sel, changed);
+        recordChange(sel, nullptr, nullptr);
+      }
+    }
+
+    updateSignals(freshSignals);
+  }
+
+  void EventSimulator::setWords(const std::vector<CoreIR::Select*>& inputs,
+                                const uint64_t* const words) {
+    SignalQueue freshSignals;
+    for (int i = 0; i < (int) inputs.size(); i++) {
+      Select* sel = inputs[i];
+      ChangeMask changed = writeWord(words[i], *getWireValue(sel));
+
+      // Words are always known, so two state mode needs no extra work
+      if ((changed != 0) && (sel->getParent() != sel->getTopParent())) {
+        changed = ALL_BITS_CHANGED;
+      }
+
+      if (changed != 0) {
+        freshSignals.push(sel, changed);
+        recordChange(sel, nullptr, nullptr);
+      }
+    }
+
+    updateSignals(freshSignals);
+  }
+
+  bool EventSimulator::enterTwoStateMode(const TwoStateOptions& options) {
+    if (options.requireKnownRegisters) {
+      auto unknownRegs = unknownRegisters();
+      if (unknownRegs.size() > 0) {
+        if (logEnabled(LOG_LEVEL_ERROR)) {
+          string msg = "ERROR: Cannot enter two state mode, registers with unknown values:";
+          for (auto& name : unknownRegs) {
+            msg += " " + name;
+          }
+          logMessage(LOG_LEVEL_ERROR, msg);
+        }
+        return false;
+      }
+    }
+
+    unknownValueSource.seed(options.seed);
+
+    vector<EventSimulator*> sims{this};
+    while (sims.size() > 0) {
+      EventSimulator* sim = sims.back();
+      sims.pop_back();
+
+      sim->twoState = true;
+      sim->twoStateOptions = options;
+      for (auto val : sim->wireValues) {
+        if (val->getType() == WIRE_VALUE_BIT) {
+          makeKnown(val);
+        }
+      }
+
+      for (auto sub : sim->submodules) {
+        sims.push_back(sub.second);
+      }
+    }
+
+    reevaluateAll();
+
+    return true;
+  }
+
+  void EventSimulator::exitTwoStateMode() {
+    twoState = false;
+    for (auto sub : submodules) {
+      sub.second->exitTwoStateMode();
+    }
+  }
+
+  // Replaces an x or z bit according to the two state policy
+  bsim::quad_value EventSimulator::knownValue(const bsim::quad_value v) {
+    if (v.is_binary()) {
+      return v;
+    }
+
+    if (twoStateOptions.policy == UNKNOWN_VALUE_RANDOM) {
+      return bsim::quad_value(unknownValueSource() & 1);
+    }
+    return bsim::quad_value(0);
+  }
+
+  BitVector EventSimulator::knownBits(const BitVector& bv) {
+    BitVector known = bv;
+    for (int i = 0; i < known.bitLength(); i++) {
+      known.set(i, knownValue(known.get(i)));
+    }
+    return known;
+  }
+
+  void EventSimulator::makeKnown(WireValue* const value) {
+    if (value->getType() == WIRE_VALUE_BIT) {
+      BitValue* b = static_cast<BitValue*>(value);
+      if (!b->value().is_binary()) {
+        b->setValue(knownValue(b->value()));
+      }
+      return;
+    }
+
+    if (value->getType() == WIRE_VALUE_ARRAY) {
+      ArrayValue* arr = static_cast<ArrayValue*>(value);
+      for (int i = 0; i < arr->length(); i++) {
+        makeKnown(arr->elemMutable(i));
+      }
+      return;
+    }
+
+    assert(value->getType() == WIRE_VALUE_RECORD);
+
+    for (auto& field : static_cast<RecordValue*>(value)->getFields()) {
+      makeKnown(field.second);
+    }
+  }
+
+  std::vector<std::string> EventSimulator::oscillatingLoops() const {
+    vector<string> names;
+    addOscillatingLoops("", names);
+    return names;
+  }
+
+  void EventSimulator::addOscillatingLoops(const std::string& prefix,
+                                           std::vector<std::string>& names) const {
+    auto& loops = tmpl->getLoops();
+    for (int i = 0; i < (int) loops.size(); i++) {
+      if (oscillating[i]) {
+        names.push_back(loopName(loops[i], prefix));
+      }
+    }
+
+    for (auto& sub : submodules) {
+      sub.second->addOscillatingLoops(prefix + sub.first->getInstname() + "$",
+                                      names);
+    }
+  }
+
+  static void collectWireBits(WireValue* const value,
+                              std::vector<BitValue*>& bits) {
+    if (value->getType() == WIRE_VALUE_BIT) {
+      bits.push_back(static_cast<BitValue*>(value));
+    } else if (value->getType() == WIRE_VALUE_ARRAY) {
+      ArrayValue* arr = static_cast<ArrayValue*>(value);
+      for (int i = 0; i < arr->length(); i++) {
+        collectWireBits(arr->elemMutable(i), bits);
+      }
+    } else {
+      for (auto& field : static_cast<RecordValue*>(value)->getFields()) {
+        collectWireBits(field.second, bits);
+      }
+    }
+  }
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return bsim::lshr(l, r);
-        });
-      
-    } else if (opName == "coreir.sub") {
+  // Storage shared by aliased wires is visited once per wire, which is
+  // harmless since each visit reads or writes the same value
+  void EventSimulator::collectBits(std::vector<BitValue*>& bits) {
+    collectWireBits(getSelfValue(), bits);
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return bsim::sub_general_width_bv(l, r);
-        });
+    for (auto instR : mod->getDef()->getInstances()) {
+      collectWireBits(getWireValue(instR.second), bits);
+    }
 
-    } else if (opName == "coreir.mul") {
+    for (auto instR : mod->getDef()->getInstances()) {
+      if (contains_key(instR.second, submodules)) {
+        submodules.at(instR.second)->collectBits(bits);
+      }
+    }
+  }
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return bsim::mul_general_width_bv(l, r);
-        });
+  void EventSimulator::restoreDerivedState() {
+    for (auto& state : registerGroupStates) {
+      state.lastClock = state.clock->value();
+    }
 
-    } else if (opName == "coreir.add") {
+    for (auto sub : submodules) {
+      sub.second->restoreDerivedState();
+    }
+  }
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return bsim::add_general_width_bv(l, r);
-        });
-      
-    } else if ((opName == "coreir.neq") || (opName == "corebit.neq")) {
+  std::vector<std::string> EventSimulator::unknownRegisters() {
+    vector<string> names;
+    for (auto instR : mod->getDef()->getInstances()) {
+      Instance* inst = instR.second;
+      OpCode op = tmpl->getOpCode(inst);
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return BitVec(1, l != r);
-        });
-      
-    } else if (opName == "coreir.ult") {
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return BitVec(1, l < r);
-        });
-    } else if (opName == "coreir.ule") {
+      if ((op == OP_REG) || (op == OP_REG_ARST)) {
+        if (!isKnown(*getWireValue(inst->sel("out")))) {
+          names.push_back(instR.first);
+        }
+      } else if (op == OP_SUBMODULE) {
+        for (auto& name : submodules.at(inst)->unknownRegisters()) {
+          names.push_back(instR.first + "$" + name);
+        }
+      }
+    }
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return BitVec(1, !(l > r));
-        });
-      
-    } else if (opName == "coreir.uge") {
+    return names;
+  }
 
-      return updateBinopNode(inst, [](const BitVec& l, const BitVec& r) {
-          return BitVec(1, l >= r);
-        });
+  void EventSimulator::reevaluateAll() {
+    for (auto sub : submodules) {
+      sub.second->reevaluateAll();
+    }
 
-    } else if ((opName == "coreir.not") || (opName == "corebit.not")) {
+    std::set<CoreIR::Select*> freshSignals;
+    for (auto selR : getSelf()->getSelects()) {
+      if (selR.second->getType()->getDir() == Type::DK_Out) {
+        freshSignals.insert(selR.second);
+      }
+    }
 
-      return updateUnopNode(inst, [](const BitVec& a) {
-          return ~a;
-        });
+    for (auto instR : mod->getDef()->getInstances()) {
+      Instance* inst = instR.second;
+      OpCode op = tmpl->getOpCode(inst);
+      if ((op == OP_CONST) || (op == OP_BIT_CONST) || (op == OP_UNSUPPORTED)) {
+        continue;
+      }
 
-    } else if ((opName == "coreir.mem") ||
-               (opName == "global.input_sr_unq1") ||
-               (opName == "global.output_sr_unq1")) {
-      // TODO: FIX THIS WITH REAL MEM IMPLEMENTATION!!!
+      updateInstance(inst);
+      for (auto selR : inst->getSelects()) {
+        if (selR.second->getType()->getDir() == Type::DK_Out) {
+          freshSignals.insert(selR.second);
+        }
+      }
+    }
 
-      return false;
-    } else if (opName == "coreir.orr") {
+    updateSignals(freshSignals);
+  }
 
-      return updateUnopNode(inst, [](const BitVec& sB) {
-          BitVec res(1, 0);
-          for (int i = 0; i < sB.bitLength(); i++) {
-            if (sB.get(i) == 1) {
-              res = BitVec(1, 1);
+  void EventSimulator::freezeConfiguration(const RegisterPredicate& isConfigRegister) {
+    freeze("", isConfigRegister, std::set<CoreIR::Select*>());
+  }
+
+  void EventSimulator::freezeConfiguration(const std::vector<std::string>& configRegisters) {
+    std::set<std::string> names(begin(configRegisters), end(configRegisters));
+    freezeConfiguration([&names](const std::string& name,
+                                 CoreIR::Instance* const reg) {
+        return dbhc::elem(name, names);
+      });
+  }
+
+  void EventSimulator::freeze(const std::string& prefix,
+                              const RegisterPredicate& isConfigRegister,
+                              const std::set<CoreIR::Select*>& constantInputs) {
+    frozenNodes.clear();
+    ignoredReceivers.clear();
+
+    std::set<Wireable*> constants(begin(constantInputs), end(constantInputs));
+    for (auto inst : tmpl->getConstants()) {
+      constants.insert(inst);
+    }
+
+    std::deque<Instance*> toCheck;
+    for (auto instR : mod->getDef()->getInstances()) {
+      Instance* inst = instR.second;
+      OpCode op = tmpl->getOpCode(inst);
+
+      if (((op == OP_REG) || (op == OP_REG_ARST)) &&
+          isConfigRegister(prefix + instR.first, inst)) {
+        frozenNodes.insert(inst);
+        constants.insert(inst);
+      }
+
+      toCheck.push_back(inst);
+    }
+
+    std::set<Instance*> selectedMuxes;
+    while (toCheck.size() > 0) {
+      Instance* inst = toCheck.front();
+      toCheck.pop_front();
+
+      if (dbhc::elem<Wireable*>(inst, constants)) {
+        continue;
+      }
+
+      if ((tmpl->getOpCode(inst) == OP_MUX) &&
+          !dbhc::elem(inst, selectedMuxes) &&
+          portIsConstant(inst, "sel", constants)) {
+        selectedMuxes.insert(inst);
+
+        updateInputs(inst);
+
+        uint64_t sel = 0;
+        readKnownWord(*getWireValue(inst->sel("sel")), sel);
+
+        string unselected = sel == 0 ? "in1" : "in0";
+        for (auto& conn : allSourceConnections(inst)) {
+          if (topPort(conn.second)->getSelStr() == unselected) {
+            ignoredReceivers.insert(cast<Select>(conn.second));
+          }
+        }
+      }
+
+      if (!tryFoldInstance(inst, constants)) {
+        continue;
+      }
+
+      constants.insert(inst);
+      frozenNodes.insert(inst);
+
+      for (auto selR : inst->getSelects()) {
+        if (selR.second->getType()->getDir() != Type::DK_Out) {
+          continue;
+        }
+
+        for (auto receiver : allReceiverSelects(selR.second)) {
+          Wireable* top = receiver->getTopParent();
+          if (isa<Instance>(top)) {
+            toCheck.push_back(cast<Instance>(top));
+          }
+        }
+      }
+    }
+
+    for (auto sub : submodules) {
+      Instance* inst = sub.first;
+      EventSimulator* sim = sub.second;
+
+      std::set<Select*> subConstants;
+      for (auto selR : inst->getSelects()) {
+        if ((selR.second->getType()->getDir() == Type::DK_In) &&
+            portIsConstant(inst, selR.first, constants)) {
+          subConstants.insert(sim->getSelf()->sel(selR.first));
+        }
+      }
+
+      sim->freeze(prefix + inst->getInstname() + "$",
+                  isConfigRegister,
+                  subConstants);
+    }
+
+    findInactiveInstances();
+  }
+
+  // Combinational logic whose outputs only reach skipped nodes, ignored
+  // mux inputs or term instances. Registers and submodules are kept so
+  // that their state is still correct if the configuration is unfrozen.
+  void EventSimulator::findInactiveInstances() {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+
+      for (auto instR : mod->getDef()->getInstances()) {
+        Instance* inst = instR.second;
+        OpCode op = tmpl->getOpCode(inst);
+        if (isSkipped(inst) ||
+            (op == OP_REG) || (op == OP_REG_ARST) || (op == OP_SUBMODULE)) {
+          continue;
+        }
+
+        bool live = false;
+        for (auto selR : inst->getSelects()) {
+          if (selR.second->getType()->getDir() != Type::DK_Out) {
+            continue;
+          }
+
+          for (auto receiver : allReceiverSelects(selR.second)) {
+            Wireable* top = receiver->getTopParent();
+            if (!isa<Instance>(top) ||
+                ((tmpl->getOpCode(cast<Instance>(top)) != OP_TERM) &&
+                 !isSkipped(top) &&
+                 !dbhc::elem(receiver, ignoredReceivers))) {
+              live = true;
               break;
             }
           }
 
-          return res;
-        });
-      
-    } else {
-      cout << "ERROR: Unsupported operation " << opName << endl;
-      assert(false);
+          if (live) {
+            break;
+          }
+        }
+
+        if (!live) {
+          frozenNodes.insert(inst);
+          changed = true;
+        }
+      }
     }
+  }
 
-    return false;
+  void EventSimulator::unfreezeConfiguration() {
+    clearFrozen();
+    reevaluateAll();
   }
 
-  std::map<CoreIR::Select*, CoreIR::BitVec>
-  EventSimulator::outputBitVecs(CoreIR::Wireable* const inst) {
-    map<Select*, BitVec> outMap;
-    for (auto selR : inst->getSelects()) {
-      Select* sel = selR.second;
-      if (sel->getType()->getDir() == Type::DirKind::DK_Out) {
+  void EventSimulator::clearFrozen() {
+    frozenNodes.clear();
+    ignoredReceivers.clear();
 
-        if (isBitType(*(sel->getType())) ||
-            isBitArray(*(sel->getType()))) {
-          outMap.insert({sel, getBitVec(sel)});
+    for (auto sub : submodules) {
+      sub.second->clearFrozen();
+    }
+  }
+
+  int EventSimulator::numFrozenNodes() const {
+    int numFrozen = frozenNodes.size();
+    for (auto sub : submodules) {
+      numFrozen += sub.second->numFrozenNodes();
+    }
+    return numFrozen;
+  }
+
+  // The node of this module that a $ separated name is in
+  static std::string observedNode(const std::string& name) {
+    CoreIR::SelectPath paths = CoreIR::splitString<CoreIR::SelectPath>(name, '$');
+    return paths.size() > 1 ? paths[0] : name;
+  }
+
+  bool EventSimulator::observe(const std::vector<std::string>& names) {
+    for (auto& name : names) {
+      if (!mod->getDef()->canSel(observedNode(name))) {
+        if (logEnabled(LOG_LEVEL_ERROR)) {
+          logMessage(LOG_LEVEL_ERROR, "ERROR: Cannot observe " + name);
+        }
+        return false;
+      }
+    }
+
+    concat(observedNames, names);
+    updateObservedCone();
+    return true;
+  }
+
+  void EventSimulator::observeAll() {
+    observedNames.clear();
+    updateObservedCone();
+  }
+
+  // Recomputes which nodes are outside the fan-in cone of the observed
+  // names, none if there are no names, and settles the nodes that were
+  // skipped until now
+  void EventSimulator::updateObservedCone() {
+    std::set<Wireable*> oldUnobserved;
+    std::swap(oldUnobserved, unobservedNodes);
+
+    // Reelaboration may have deleted observed nodes
+    vector<string> remaining;
+    for (auto& name : observedNames) {
+      if (mod->getDef()->canSel(observedNode(name))) {
+        remaining.push_back(name);
+      } else if (logEnabled(LOG_LEVEL_WARNING)) {
+        logMessage(LOG_LEVEL_WARNING,
+                   "WARNING: No longer observing deleted signal " + name);
+      }
+    }
+    observedNames = remaining;
+
+    Wireable* self = getSelf();
+    if (observedNames.size() > 0) {
+      IntervalList cone;
+      for (auto& name : observedNames) {
+        Wireable* w = mod->getDef()->sel(observedNode(name));
+        Wireable* top = w->getTopParent();
+        if (top == self) {
+          concat(cone, portCone(*tmpl, getSourceSelects(w), true));
         } else {
-          for (auto sBp : outputBitVecs(sel)) {
-            outMap.insert(sBp);
-          }
+          int id = tmpl->getConeId(top);
+          cone.push_back({id, id + 1});
+          concat(cone, tmpl->getDriverCone(top));
+        }
+      }
+      cone = coalesce(cone);
+
+      for (int id = 0; id < tmpl->getNumConeNodes(); id++) {
+        Wireable* node = tmpl->getConeNode(id);
+        if ((node != self) && !containsId(cone, id)) {
+          unobservedNodes.insert(node);
         }
       }
     }
-    return outMap;
+
+    // Only nodes still in the definition, since reelaboration may have
+    // deleted some of the old ones
+    std::set<Wireable*> entered;
+    for (int id = 0; id < tmpl->getNumConeNodes(); id++) {
+      Wireable* node = tmpl->getConeNode(id);
+      if (dbhc::elem(node, oldUnobserved) &&
+          !dbhc::elem(node, unobservedNodes)) {
+        entered.insert(node);
+      }
+    }
+    settle(entered);
   }
 
-  // Move this to wiring utils
-  std::set<CoreIR::Select*>
-  EventSimulator::sourceDrivers(CoreIR::Wireable* const w) {
-    set<Select*> srcs;
-    vector<Select*> toCheck = getSourceSelects(w);
+  bool EventSimulator::reelaborate() {
+    assert(container == nullptr);
 
-    while (toCheck.size() > 0) {
-      Select* next = toCheck.back();
-      toCheck.pop_back();
+    clearFrozen();
 
-      auto nextSrcs = getSourceSelects(next->getTopParent());
-      if ((next->getTopParent() == mod->getDef()->sel("self")) ||
-          (nextSrcs.size() == 0)) {
-        srcs.insert(next);
-      } else {
-        concat(toCheck, nextSrcs);
+    ModuleTemplateCache* oldTemplates = templates;
+    templates = new ModuleTemplateCache(oldTemplates->prunesDeadLogic(),
+                                        oldTemplates->aliasesWires());
+    templates->build(mod, oldTemplates);
+
+    bool changed = patch();
+    if (observedNames.size() > 0) {
+      updateObservedCone();
+    }
+
+    delete oldTemplates;
+
+    return changed;
+  }
+
+  // Moves this simulator and its submodules to the current templates.
+  // The old templates stay alive until the whole hierarchy is patched.
+  bool EventSimulator::patch() {
+    if (container != nullptr) {
+      templates = container->templates;
+    }
+
+    ModuleTemplate* fresh = templates->get(mod);
+    if (fresh != tmpl) {
+      rebuild(fresh);
+      return true;
+    }
+
+    std::set<Wireable*> changedSubmodules;
+    for (auto sub : submodules) {
+      if (sub.second->patch()) {
+        changedSubmodules.insert(sub.first);
       }
     }
-    
-    return srcs;
+
+    // Rebuilt submodules have new storage and register groups
+    if (changedSubmodules.size() > 0) {
+      resolveClockFanOut();
+    }
+
+    settle(changedSubmodules);
+
+    return changedSubmodules.size() > 0;
   }
 
-  // Q: What kinds of facilities would be useful for hardware debugging?
-  // A: Displaying the calculation that lead to a given value?
-  //    Thm prover based suggestions about what would make a given port have its expected value
+  // Copies either the input ports or all other ports of node from an old
+  // value of node
+  static void copyPorts(CoreIR::Wireable* const node,
+                        WireValue* const receiver,
+                        const WireValue* const source,
+                        const bool inputs) {
+    auto ports = cast<RecordType>(node->getType())->getRecord();
+    auto& to = static_cast<RecordValue*>(receiver)->getFields();
+    auto& from = static_cast<const RecordValue*>(source)->getFields();
+
+    assert(to.size() == from.size());
+
+    for (int i = 0; i < (int) to.size(); i++) {
+      bool isInput = ports.at(to[i].first)->getDir() == Type::DK_In;
+      if (isInput == inputs) {
+        copyWireValueOver(to[i].second, from[i].second);
+      }
+    }
+  }
 
-  void EventSimulator::printInstances(const std::string& instanceName) {
-    for (auto instanceR : mod->getDef()->getInstances()) {
-      auto inst = instanceR.second;
-      if (getQualifiedOpName(*inst) == instanceName) {
-        cout << "\t" << inst->toString() << " = " << *getWireValue(inst) << endl;
+  void EventSimulator::rebuild(ModuleTemplate* const fresh) {
+    ModuleTemplate* oldTmpl = tmpl;
+    tmpl = fresh;
+
+    map<Wireable*, WireValue*> oldValues;
+    vector<WireValue*> oldStorage;
+    map<Instance*, EventSimulator*> oldSubmodules;
+    std::swap(values, oldValues);
+    std::swap(wireValues, oldStorage);
+    std::swap(submodules, oldSubmodules);
+
+    auto def = mod->getDef();
+    Wireable* self = def->sel("self");
+
+    values[self] = instantiateWireValue(tmpl->getDefaultValue(self));
+    for (auto instR : def->getInstances()) {
+      values[instR.second] =
+        instantiateWireValue(tmpl->getDefaultValue(instR.second));
+    }
+
+    // The slot table still points into the old storage and is numbered by
+    // the old template, so selects are looked up by walking the new values
+    // until resolvePortValues rebuilds it
+    selectValues.clear();
+
+    for (auto& alias : tmpl->getAliases()) {
+      shareStorage(alias.first, getWireValue(alias.second));
+    }
+
+    resolvePortValues();
+    resolveRegisterGroups();
+    resolveSchedule();
+
+    if (causality != nullptr) {
+      queuedBy.assign(def->getInstances().size(), nullptr);
+    }
+
+    // Nodes that kept their name and module keep their values. Inputs are
+    // copied before outputs because inputs may share the storage of the
+    // outputs driving them, which must end up with the old outputs.
+    std::set<Wireable*> toSettle;
+    vector<Wireable*> kept;
+    if (contains_key(self, oldValues)) {
+      kept.push_back(self);
+    }
+
+    for (auto instR : def->getInstances()) {
+      Instance* inst = instR.second;
+      if (!oldTmpl->hadInstance(inst)) {
+        toSettle.insert(inst);
+
+        if (inst->getModuleRef()->hasDef()) {
+          submodules[inst] = new EventSimulator(inst->getModuleRef(), inst, this);
+          inheritModes(submodules[inst]);
+        }
+        continue;
+      }
+
+      kept.push_back(inst);
+
+      if (contains_key(inst, oldSubmodules)) {
+        submodules[inst] = oldSubmodules.at(inst);
+        oldSubmodules.erase(inst);
+
+        if (submodules[inst]->patch()) {
+          toSettle.insert(inst);
+        }
       }
     }
 
+    resolveClockFanOut();
 
-    for (auto subMod : submodules) {
-      cout << "In submodule " << subMod.first->toString() << endl;
-      subMod.second->printInstances(instanceName);
+    for (bool inputs : {true, false}) {
+      for (auto node : kept) {
+        copyPorts(node, values.at(node), oldValues.at(node), inputs);
+      }
+    }
+
+    for (auto node : kept) {
+      string name = isa<Instance>(node) ? cast<Instance>(node)->getInstname() : "self";
+      if (!oldTmpl->hasFanInKey(name) ||
+          (oldTmpl->getFanInKey(name) != tmpl->getFanInKey(name))) {
+        toSettle.insert(node);
+      }
+    }
+
+    for (auto sub : oldSubmodules) {
+      delete sub.second;
     }
+    for (auto val : oldStorage) {
+      delete val;
+    }
+
+    if (twoState) {
+      for (auto val : values) {
+        makeKnown(val.second);
+      }
+    }
+
+    initializeConstants(ElaborationCallback(), false);
+
+    settle(toSettle);
   }
 
-  void EventSimulator::setValues(const std::vector<std::pair<std::string, CoreIR::BitVec> >& values) {
-    std::set<CoreIR::Select*> freshSignals;
-    for (auto signal : values) {
+  // Gives a submodule created by rebuild the causality log and two state
+  // mode the rest of the hierarchy already has
+  void EventSimulator::inheritModes(EventSimulator* const sub) {
+    if (causality != nullptr) {
+      sub->enableCausalityLog(causality->capacity());
+    }
 
-      auto name = signal.first;
-      assert(mod->getDef()->canSel(name));
-      CoreIR::Wireable* s = mod->getDef()->sel(name);
+    if (!twoState) {
+      return;
+    }
 
-      assert(CoreIR::isa<CoreIR::Select>(s));
+    vector<EventSimulator*> sims{sub};
+    while (sims.size() > 0) {
+      EventSimulator* sim = sims.back();
+      sims.pop_back();
 
-      CoreIR::Select* sel = CoreIR::cast<CoreIR::Select>(s);
-      
-      setValueNoUpdate(sel, signal.second);
-      freshSignals.insert(sel);
+      sim->twoState = true;
+      sim->twoStateOptions = twoStateOptions;
+      for (auto val : sim->wireValues) {
+        if (val->getType() == WIRE_VALUE_BIT) {
+          makeKnown(val);
+        }
+      }
+
+      for (auto subR : sim->submodules) {
+        sims.push_back(subR.second);
+      }
+    }
+
+    sub->reevaluateAll();
+  }
+
+  // Evaluates nodes and propagates whatever changed
+  void EventSimulator::settle(const std::set<CoreIR::Wireable*>& nodes) {
+    SignalQueue freshSignals;
+    for (auto node : nodes) {
+      if (!isa<Instance>(node)) {
+        updateInputs(node);
+        continue;
+      }
+
+      if (isSkipped(node)) {
+        continue;
+      }
+
+      ChangeMask changed = updateInstance(cast<Instance>(node));
+      if (changed == 0) {
+        continue;
+      }
+
+      scheduleOutputs(cast<Instance>(node), changed, freshSignals);
     }
 
     updateSignals(freshSignals);
@@ -2,7 +2,11 @@
 
 #include "coreir.h"
 
+#include <mutex>
+#include <random>
+
 #include "algorithm.h"
+#include "logging.h"
 
 namespace EventSim {
 
@@ -51,20 +55,15 @@ namespace EventSim {
 
     void setFieldValue(const std::string& fieldName,
                        WireValue* wv) {
-      bool found = false;
-      std::vector<std::pair<std::string, WireValue*> > fresh_fields;
-
-      for (int i = 0; i < ((int) fields.size()); i++) {
-        if (fields[i].first == fieldName) {
-          fresh_fields.push_back({fields[i].first, wv});
-          found = true;
-        } else {
-          fresh_fields.push_back(fields[i]);
+      for (auto& field : fields) {
+        if (field.first == fieldName) {
+          field.second = wv;
+          return;
         }
       }
 
-      assert(found);
-      fields = fresh_fields;
+      std::cout << "ERROR: Record does not contain field " << fieldName << std::endl;
+      assert(false);
     }
 
     WireValue* getFieldValue(const std::string& fieldName) const {
@@ -103,6 +102,11 @@ namespace EventSim {
 
     WireValue* const elemMutable(const int i) const { return elems[i]; }
     int length() const { return elems.size(); }
+
+    void setElem(const int i, WireValue* const wv) {
+      assert(i < length());
+      elems[i] = wv;
+    }
   };
 
   class BitValue : public WireValue {
@@ -147,182 +151,948 @@ namespace EventSim {
 
   void setWireBitVector(const BitVector& bv, WireValue& value);
   BitVector extractBitVector(const WireValue& value);
-  
-  class EventSimulator {
-    CoreIR::Module* mod;
 
-    std::map<CoreIR::Wireable*, WireValue*> values;
+  // Bit i of a bit or a bit array
+  static inline BitValue* bitAt(WireValue* const value, const int i) {
+    if (value->getType() == WIRE_VALUE_BIT) {
+      assert(i == 0);
+      return static_cast<BitValue*>(value);
+    }
 
-    std::set<WireValue*> wireValues;
+    assert(value->getType() == WIRE_VALUE_ARRAY);
 
-    std::map<CoreIR::Instance*, EventSimulator*> submodules;
+    WireValue* b = static_cast<ArrayValue*>(value)->elemMutable(i);
 
-    CoreIR::Instance* instanceBeingSimulated;
-    EventSimulator* container;
+    assert(b->getType() == WIRE_VALUE_BIT);
 
-    std::map<CoreIR::Wireable*, std::vector<CoreIR::Connection> > sourceConnectionCache;
-    std::map<CoreIR::Wireable*, std::vector<CoreIR::Select*> > receiverSelectsCache;
+    return static_cast<BitValue*>(b);
+  }
 
+  static inline bool sameQuadValue(const bsim::quad_value a,
+                                   const bsim::quad_value b) {
+    if (a.is_binary()) {
+      return b.is_binary() && (a.binary_value() == b.binary_value());
+    }
 
-  public:
+    if (a.is_unknown()) {
+      return b.is_unknown();
+    }
 
-    const std::vector<CoreIR::Connection>&
-    allSourceConnections(CoreIR::Wireable* const w) {
-      if (contains_key(w, sourceConnectionCache)) {
-        return sourceConnectionCache.at(w);
-      }
+    return b.is_high_impedance();
+  }
+
+  static inline bool setBit(BitValue* const b, const bsim::quad_value v) {
+    if (sameQuadValue(b->value(), v)) {
+      return false;
+    }
 
-      auto conns = getSourceConnections(w);
-      sourceConnectionCache.insert({w, conns});
+    b->setValue(v);
+    return true;
+  }
+
+  // Bit i is set if bit i of a value changed. Bits 63 and up all map to
+  // bit 63, so masks are only exact for values narrower than 64 bits.
+  typedef uint64_t ChangeMask;
+
+  static const ChangeMask ALL_BITS_CHANGED = ~((ChangeMask) 0);
+
+  static inline ChangeMask changedBit(const int i) {
+    return ((ChangeMask) 1) << std::min(i, 63);
+  }
 
-      return sourceConnectionCache.at(w);
+  // Bits lo through hi - 1
+  static inline ChangeMask changedRange(const int lo, const int hi) {
+    if (hi <= lo) {
+      return 0;
     }
 
-    const std::vector<CoreIR::Select*>&
-    allReceiverSelects(CoreIR::Wireable* const w) {
-      if (contains_key(w, receiverSelectsCache)) {
-        return receiverSelectsCache.at(w);
-      }
+    int top = std::min(hi - 1, 63);
+    ChangeMask upTo =
+      top == 63 ? ALL_BITS_CHANGED : ((((ChangeMask) 1) << (top + 1)) - 1);
+
+    return upTo & ~(changedBit(lo) - 1);
+  }
+
+  // Variants of setWireBitVector and copyWireValueOver that report which
+  // bits of the receiver changed. Elements of arrays count as one bit and
+  // any change to a record changes every bit.
+  ChangeMask updateWireBitVector(const BitVector& bv, WireValue& value);
+  ChangeMask updateWireValue(WireValue* const receiver,
+                             const WireValue* const source);
+
+  int bitWidth(const WireValue& value);
+
+  // True if no bit of value is x or z
+  bool isKnown(const WireValue& value);
+
+  // Two state access to bits and bit arrays of at most 64 bits. Reading
+  // fails, leaving word untouched, if any bit is x or z.
+  bool readKnownWord(const WireValue& value, uint64_t& word);
+  ChangeMask writeWord(const uint64_t word, WireValue& value);
+
+  // Four state read of a bit or bit array of at most 64 bits. Bit i of
+  // unknown is set if bit i of value is x or z, and bit i of word is then
+  // 0.
+  void readWord(const WireValue& value, uint64_t& word, uint64_t& unknown);
 
-      auto receivers = getReceiverSelects(w);
-      receiverSelectsCache.insert({w, receivers});
+  uint64_t ashrWord(const uint64_t word, const uint64_t shift, const int width);
 
-      return receiverSelectsCache.at(w);
+  // Output ports whose value changed, with the bits of each that changed
+  class SignalQueue {
+    std::map<CoreIR::Select*, ChangeMask> signals;
+
+  public:
+
+    void push(CoreIR::Select* const sel, const ChangeMask mask) {
+      signals[sel] |= mask;
     }
-    
-    EventSimulator(CoreIR::Module* const mod_) :
-      EventSimulator(mod_, nullptr, nullptr) {
+
+    bool empty() const { return signals.size() == 0; }
+
+    std::pair<CoreIR::Select*, ChangeMask> pop() {
+      auto next = *std::begin(signals);
+      signals.erase(std::begin(signals));
+      return next;
     }
+  };
 
-    EventSimulator(CoreIR::Module* const mod_,
-                   CoreIR::Instance* const instanceBeingSimulated_,
-                   EventSimulator* const container_) : mod(mod_), instanceBeingSimulated(instanceBeingSimulated_), container(container_) {
-      assert(mod != nullptr);
-      assert(mod->hasDef());
+  // Instances waiting to be evaluated, popped lowest rank first so that
+  // logic outside of combinational loops is evaluated at most once per
+  // batch of events
+  class NodeQueue {
+    std::vector<std::vector<std::pair<CoreIR::Instance*, int> > > buckets;
+    std::vector<bool> queued;
+    int lowest;
+    int numQueued;
 
-      auto def = mod->getDef();
-      CoreIR::Wireable* self = def->sel("self");
+  public:
 
-      if (container == nullptr) {
-        std::cout << "Initializing " << mod->getName() << std::endl;
+    NodeQueue() : lowest(0), numQueued(0) {}
+
+    void resize(const int numRanks, const int numNodes) {
+      buckets.assign(numRanks, {});
+      queued.assign(numNodes, false);
+      lowest = numRanks;
+      numQueued = 0;
+    }
+
+    void push(CoreIR::Instance* const inst, const int rank, const int index) {
+      if (queued[index]) {
+        return;
       }
-      // Add interface default values
-      values[self] = defaultWireValue(self);
 
-      for (auto instR : def->getInstances()) {
+      queued[index] = true;
+      buckets[rank].push_back({inst, index});
+      lowest = std::min(lowest, rank);
+      numQueued++;
+    }
 
-        if (container == nullptr) {
-          std::cout << "Initializing " << instR.first << std::endl;
-        }
+    bool empty() const { return numQueued == 0; }
+
+    CoreIR::Instance* pop() {
+      while (buckets[lowest].size() == 0) {
+        lowest++;
+      }
 
-        values[instR.second] = defaultWireValue(instR.second);
+      auto next = buckets[lowest].back();
+      buckets[lowest].pop_back();
+      queued[next.second] = false;
+      numQueued--;
+      return next.first;
+    }
+  };
+
+  enum ElaborationPhase {
+    ELABORATION_PHASE_VALUES,
+    ELABORATION_PHASE_CONSTANTS
+  };
+
+  // Called once per instance of the top level module in each phase of
+  // elaboration with the number of instances finished so far. Constants
+  // and folded instances are reported first in the constants phase.
+  typedef std::function<void(const ElaborationPhase phase,
+                             const int numDone,
+                             const int numInstances,
+                             CoreIR::Instance* const inst)> ElaborationCallback;
+
+  struct ElaborationOptions {
+    ElaborationCallback progress;
+
+    // Number of threads used to build the submodule simulators of the top
+    // level module. 0 means one per hardware thread.
+    int numThreads;
+
+    // Evaluate logic whose inputs are all constant once at elaboration and
+    // never again.
+    bool foldConstants;
+
+    // Never evaluate instances whose outputs only reach term instances or
+    // nothing at all, including unloaded registers and submodules. Their
+    // values go stale, so getBitVec and getValueHandle on them no longer
+    // reflect the simulation. Off by default.
+    bool pruneDeadLogic;
+
+    // Store nets joined only by connections and single bit wraps once,
+    // so no values are copied along them and wraps are never evaluated.
+    bool aliasWires;
+
+    // Evaluations of each instance of a combinational loop allowed while
+    // propagating one batch of events. Loops that have not settled by then
+    // are reported as oscillating and stop being evaluated for the batch.
+    int maxLoopIterations;
+
+    ElaborationOptions() :
+      numThreads(1),
+      foldConstants(true),
+      pruneDeadLogic(false),
+      aliasWires(true),
+      maxLoopIterations(256) {}
+  };
+
+  enum OpCode {
+    OP_UNSUPPORTED,
+    OP_SUBMODULE,
+    OP_CONST,
+    OP_BIT_CONST,
+    OP_TERM,
+    OP_UNIMPLEMENTED,
+    OP_ANDR,
+    OP_ORR,
+    OP_MUX,
+    OP_SLICE,
+    OP_ZEXT,
+    OP_WRAP,
+    OP_REG,
+    OP_REG_ARST,
+    OP_EQ,
+    OP_NEQ,
+    OP_ULT,
+    OP_ULE,
+    OP_UGE,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_NOT,
+    OP_SHL,
+    OP_ASHR,
+    OP_LSHR,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL
+  };
+
+  OpCode resolveOpCode(CoreIR::Instance* const inst);
+
+  // Module and generator arguments of an instance, decoded once per module.
+  // Only the fields used by the instance's opcode are set.
+  struct InstanceParams {
+    int lo;
+    int hi;
+    int widthIn;
+    int widthOut;
+    bool clkPosedge;
+    bool arstPosedge;
+
+    // The init value is bound by the instance being simulated, so it is
+    // resolved by each simulator rather than stored here
+    bool symbolicInit;
+  };
+
+  InstanceParams decodeParams(CoreIR::Instance* const inst, const OpCode op);
+
+  // An instance's opcode, parameters and the ports its evaluator uses,
+  // looked up once per module. Ports the instance does not have are null.
+  struct InstanceInfo {
+    int index;
+    OpCode op;
+    InstanceParams params;
+    CoreIR::Select* in0;
+    CoreIR::Select* in1;
+    CoreIR::Select* in;
+    CoreIR::Select* sel;
+    CoreIR::Select* clk;
+    CoreIR::Select* arst;
+    CoreIR::Select* out;
+
+    // Every output port, in the order of the instance's type
+    std::vector<CoreIR::Select*> outputs;
+
+    // Position of the instance's combinational loop (or of the instance
+    // alone) in topological order. Instances of one loop share a rank.
+    int rank;
+  };
+
+  // Storage of the ports in an InstanceInfo in one simulator, and the
+  // receiver and driver storage of every connection into the instance
+  // that is copied rather than shared
+  struct PortValues {
+    WireValue* in0;
+    WireValue* in1;
+    WireValue* in;
+    WireValue* sel;
+    WireValue* clk;
+    WireValue* arst;
+    WireValue* out;
+
+    // Value loaded into out on reset, for registers with async reset
+    WireValue* init;
+
+    std::vector<std::pair<WireValue*, const WireValue*> > copies;
+
+    // The subset of copies into in, which is all a clock edge samples
+    std::vector<std::pair<WireValue*, const WireValue*> > inCopies;
+  };
+
+  // Registers clocked by the same net on the same edge. clock is the
+  // driver at the root of the clock net.
+  struct RegisterGroup {
+    CoreIR::Select* clock;
+    bool posedge;
+    std::vector<CoreIR::Instance*> registers;
+  };
+
+  // A register group in one simulator: the clock bit, its value when the
+  // group last saw it, and space to sample every register input into
+  struct RegisterGroupState {
+    BitValue* clock;
+    bsim::quad_value lastClock;
+    std::vector<WireValue*> sampled;
+
+    // Set when the inputs were sampled ahead of the clock edge reaching
+    // this simulator, so clockRegisters must not sample them again
+    bool presampled;
+  };
 
-        if (instR.second->getModuleRef()->hasDef()) {
-          submodules[instR.second] =
-            new EventSimulator(instR.second->getModuleRef(), instR.second, this);
+  // A change to the value of a net, recorded while propagating events.
+  // Only the low 64 bits of the new value are kept.
+  struct CausalityEvent {
+    // Index of the batch of events (call to updateSignals) the change was
+    // part of, and the number of instances evaluated earlier in the batch
+    uint64_t time;
+    uint32_t delta;
+
+    CoreIR::Select* net;
+    uint64_t value;
+    uint64_t unknown;
+
+    // The instance whose evaluation changed net and the net whose change
+    // caused that evaluation. Both are null for inputs set by the user.
+    CoreIR::Instance* cause;
+    CoreIR::Select* causeInput;
+  };
+
+  // Fixed size ring buffer of the most recent causality events
+  class CausalityLog {
+    std::vector<CausalityEvent> events;
+    size_t next;
+    size_t count;
+
+  public:
+
+    CausalityLog(const size_t capacity) :
+      events(capacity), next(0), count(0) {
+      assert(capacity > 0);
+    }
+
+    void record(const CausalityEvent& event) {
+      events[next] = event;
+      next = (next + 1) % events.size();
+      count = std::min(count + 1, events.size());
+    }
+
+    int size() const { return count; }
+
+    size_t capacity() const { return events.size(); }
+
+    // Event i, counting from the oldest event still in the log
+    const CausalityEvent& at(const int i) const {
+      return events[(next + events.size() - count + i) % events.size()];
+    }
+
+    // The newest event on net older than event before, or -1
+    int findLatest(CoreIR::Select* const net, const int before) const {
+      for (int i = before - 1; i >= 0; i--) {
+        if (at(i).net == net) {
+          return i;
         }
       }
+      return -1;
+    }
+  };
 
-      if (container == nullptr) {
-        std::cout << "Done setting X values " << std::endl;
-      }
-      
-      // Set default values for wires that are not initialized to x
-      int numInitialized = 0;
-      for (auto instR : def->getInstances()) {
+  // One step of the chain of events that produced a value, as returned
+  // by EventSimulator::explain
+  struct CausalityStep {
+    std::string net;
+    uint64_t time;
+    uint32_t delta;
+    uint64_t value;
+    uint64_t unknown;
+
+    // Empty for inputs set by the user
+    std::string cause;
+    bool causeIsRegister;
+  };
 
-        if (container == nullptr) {
-          std::cout << "Initializing instance # " << numInitialized << ": " << instR.first << ", type = " << CoreIR::getQualifiedOpName(*(instR.second)) << std::endl;
-        }
+  enum UnknownValuePolicy {
+    UNKNOWN_VALUE_ZERO,
+    UNKNOWN_VALUE_RANDOM
+  };
 
-        if (CoreIR::getQualifiedOpName(*(instR.second)) == "corebit.const") {
-          bool value = instR.second->getModArgs().at("value")->get<bool>();
-          setValue(instR.second->sel("out"), CoreIR::BitVec(1, value));
-        }
+  struct TwoStateOptions {
+    // How x and z bits are replaced when entering two state mode and when
+    // inputs with x or z bits are set afterwards
+    UnknownValuePolicy policy;
+    unsigned int seed;
 
-        if (CoreIR::getQualifiedOpName(*(instR.second)) == "coreir.const") {
-          BitVector value =
-            instR.second->getModArgs().at("value")->get<BitVector>();
+    // Refuse to switch modes if any register still holds an x or z bit,
+    // which usually means reset did not reach it
+    bool requireKnownRegisters;
 
-          if (container == nullptr) {
-            std::cout << "\tSetting const value" << std::endl;
-          }
+    TwoStateOptions() :
+      policy(UNKNOWN_VALUE_ZERO), seed(0), requireKnownRegisters(false) {}
+  };
+
+  // Work done propagating events, summed over a simulator and its
+  // submodules
+  struct EventStats {
+    // Signals popped from the event queue
+    long signalsProcessed;
+
+    // Calls to updateInstance from the event loop
+    long nodesEvaluated;
+
+    // Output ports pushed onto the event queue after an evaluation
+    long outputsScheduled;
+  };
+
+  // Sorted, disjoint, half open ranges of node ids
+  typedef std::vector<std::pair<int, int> > IntervalList;
+
+  // Receives the $ separated name of a register and the register itself
+  typedef std::function<bool(const std::string& name,
+                             CoreIR::Instance* const reg)> RegisterPredicate;
+
+  // Elaboration data that depends only on a CoreIR module, shared by every
+  // simulator of that module. Templates are built serially before any
+  // simulator is constructed, which also creates every select the
+  // simulators will touch, so parallel elaboration only reads the graph.
+  class ModuleTemplate {
+    CoreIR::Module* mod;
+
+    // Value layout of the interface and of every instance, with all bits
+    // set to x. Simulators copy these instead of re-walking CoreIR types.
+    std::map<CoreIR::Wireable*, WireValue*> defaultValues;
+
+    std::vector<WireValue*> ownedValues;
+
+    // Connectivity is a property of the ModuleDef, so every instance of
+    // the module shares these tables. Fan-in is keyed by the interface and
+    // by instances, fan-out by every select in the definition.
+    std::map<CoreIR::Wireable*, std::vector<CoreIR::Connection> > sourceConnections;
+    std::map<CoreIR::Wireable*, std::vector<CoreIR::Select*> > receiverSelects;
+
+    // Fan-out lists used to propagate events, which leave out the data and
+    // clock inputs of registers in a register group. For each receiver,
+    // the bits of the driving port that the receiving node reads through
+    // it.
+    std::map<CoreIR::Wireable*, std::vector<CoreIR::Select*> > eventReceivers;
+    std::map<CoreIR::Wireable*, std::vector<ChangeMask> > consumedBits;
+
+    std::vector<RegisterGroup> registerGroups;
+    std::set<CoreIR::Instance*> groupedRegisters;
+
+    // Register groups keyed by the port their clock is part of
+    std::map<CoreIR::Select*, std::vector<int> > clockedGroups;
+
+    // Instances of each combinational loop, and the loop at each rank or
+    // -1 for ranks that are not part of a loop
+    std::vector<std::vector<CoreIR::Instance*> > loops;
+    std::vector<int> rankLoops;
+
+    // Transitive drivers and loads of every node as ranges of node ids,
+    // shared by the members of each strongly connected component. Node
+    // ids number the interface and the instances, drivers first.
+    std::vector<CoreIR::Wireable*> coneNodes;
+    std::unordered_map<CoreIR::Wireable*, int> coneIds;
+    std::vector<IntervalList> driverCones;
+    std::vector<int> driverConeOf;
+    std::vector<IntervalList> loadCones;
+    std::vector<int> loadConeOf;
+
+    // For each node id, the selects driving it that belong to the
+    // interface or to an instance with nothing connected to its inputs
+    std::vector<std::vector<CoreIR::Select*> > leafDrivers;
+
+    std::map<CoreIR::Instance*, InstanceInfo> instanceInfo;
+
+    // Constant instances followed by every instance folded into a
+    // constant, in the order they must be evaluated. Folding needs values,
+    // so it is done by the first simulator of the module to be elaborated.
+    std::once_flag constantsFlag;
+    std::vector<CoreIR::Instance*> constantOrder;
+
+    // Instances that are never evaluated during simulation
+    std::set<CoreIR::Wireable*> prunedNodes;
+
+    // Receivers that share the storage of the driver at the root of their
+    // net, paired with that driver. Connections into them are dropped from
+    // copiedConnections and fan-out skips over the wraps between them.
+    std::vector<std::pair<CoreIR::Select*, CoreIR::Select*> > aliases;
+    std::set<CoreIR::Instance*> aliasedWraps;
+    std::map<CoreIR::Wireable*, std::vector<CoreIR::Connection> > copiedConnections;
+
+    // Every select in the definition numbered densely, with its top parent
+    // and the field and element indices leading to it from there
+    std::unordered_map<CoreIR::Select*, int> selectSlots;
+    std::vector<std::pair<CoreIR::Wireable*, std::vector<int> > > selectPaths;
+
+    // The definition the template was built from: each instance with its
+    // module, and a description of the connections into each node keyed
+    // by instance name, or "self" for the interface
+    std::map<std::string, std::pair<CoreIR::Instance*, CoreIR::Module*> > instanceNames;
+    std::map<std::string, std::string> fanInKeys;
+
+    // Direction of each interface field as seen by an instance of mod
+    std::vector<CoreIR::Type::DirKind> portDirections;
+    std::vector<CoreIR::Select*> portSelects;
+
+    WireValue* defaultWireValue(CoreIR::Wireable* const w);
+
+    void findAliases();
+    bool canAlias(const CoreIR::Connection& conn);
+    CoreIR::Select* aliasRoot(CoreIR::Select* const driver);
+    void addAliasedReceivers(const std::vector<CoreIR::Select*>& receivers,
+                             std::vector<CoreIR::Select*>& expanded);
+
+    void findRegisterGroups();
+    void findEventReceivers();
+    void rankInstances();
+    void indexCones();
+    std::map<std::string, std::string> currentFanInKeys() const;
+    void indexSelects(CoreIR::Wireable* const w,
+                      const WireValue* const value,
+                      CoreIR::Wireable* const top,
+                      std::vector<int>& path);
+    ChangeMask consumedBitsOf(CoreIR::Select* const receiver,
+                              CoreIR::Select* const driver);
+
+    void findDeadInstances();
+
+    void addReceiverSelects(CoreIR::Wireable* const w);
+
+  public:
+    ModuleTemplate(CoreIR::Module* const mod_,
+                   const bool pruneDeadLogic,
+                   const bool aliasWires);
+
+    CoreIR::Module* getModule() const { return mod; }
+
+    const WireValue* getDefaultValue(CoreIR::Wireable* const w) const {
+      assert(contains_key(w, defaultValues));
+      return defaultValues.at(w);
+    }
+
+    const std::vector<CoreIR::Connection>&
+    getFanIn(CoreIR::Wireable* const w) const {
+      assert(contains_key(w, sourceConnections));
+      return sourceConnections.at(w);
+    }
+
+    const std::vector<CoreIR::Select*>&
+    getFanOut(CoreIR::Wireable* const w) const {
+      assert(contains_key(w, receiverSelects));
+      return receiverSelects.at(w);
+    }
+
+    const std::map<CoreIR::Wireable*, std::vector<CoreIR::Select*> >&
+    getAllEventReceivers() const {
+      return eventReceivers;
+    }
+
+    const std::vector<CoreIR::Select*>&
+    getEventReceivers(CoreIR::Wireable* const w) const {
+      assert(contains_key(w, eventReceivers));
+      return eventReceivers.at(w);
+    }
+
+    // Parallel to getEventReceivers(w)
+    const std::vector<ChangeMask>&
+    getConsumedBits(CoreIR::Wireable* const w) const {
+      assert(contains_key(w, consumedBits));
+      return consumedBits.at(w);
+    }
+
+    const std::vector<RegisterGroup>& getRegisterGroups() const {
+      return registerGroups;
+    }
+
+    int getNumRanks() const { return rankLoops.size(); }
+
+    // Index into getLoops, or -1 if rank is not a combinational loop
+    int getLoopOfRank(const int rank) const { return rankLoops[rank]; }
+
+    const std::vector<std::vector<CoreIR::Instance*> >& getLoops() const {
+      return loops;
+    }
+
+    int getNumConeNodes() const { return coneNodes.size(); }
+
+    int getConeId(CoreIR::Wireable* const node) const {
+      assert(contains_key(node, coneIds));
+      return coneIds.at(node);
+    }
+
+    CoreIR::Wireable* getConeNode(const int id) const { return coneNodes[id]; }
+
+    // Every node node depends on, through registers but not back through
+    // the interface. Node is included only if it is part of a cycle.
+    const IntervalList& getDriverCone(CoreIR::Wireable* const node) const {
+      return driverCones[driverConeOf[getConeId(node)]];
+    }
+
+    // Every node that depends on node, the reverse of getDriverCone
+    const IntervalList& getLoadCone(CoreIR::Wireable* const node) const {
+      return loadCones[loadConeOf[getConeId(node)]];
+    }
+
+    const std::vector<CoreIR::Select*>&
+    getLeafDrivers(CoreIR::Wireable* const node) const {
+      return leafDrivers[getConeId(node)];
+    }
+
+    bool isTransitiveDriver(CoreIR::Wireable* const driver,
+                            CoreIR::Wireable* const node) const;
+
+    std::vector<CoreIR::Wireable*> coneMembers(const IntervalList& cone) const;
+
+    // Null if no register is clocked by port
+    const std::vector<int>* getClockedGroups(CoreIR::Select* const port) const {
+      auto groups = clockedGroups.find(port);
+      return groups == std::end(clockedGroups) ? nullptr : &(groups->second);
+    }
+
+    // Connections whose values must still be copied into the receiver
+    const std::vector<CoreIR::Connection>&
+    getCopiedConnections(CoreIR::Wireable* const w) const {
+      assert(contains_key(w, copiedConnections));
+      return copiedConnections.at(w);
+    }
+
+    const std::vector<std::pair<CoreIR::Select*, CoreIR::Select*> >&
+    getAliases() const {
+      return aliases;
+    }
+
+    // False once instances or connections of the definition are edited
+    bool matchesDefinition() const;
+
+    // True if inst was in the definition the template was built from
+    bool hadInstance(CoreIR::Instance* const inst) const {
+      auto old = instanceNames.find(inst->getInstname());
+      return (old != std::end(instanceNames)) &&
+        (old->second.first == inst) &&
+        (old->second.second == inst->getModuleRef());
+    }
+
+    const std::string& getFanInKey(const std::string& nodeName) const {
+      assert(contains_key(nodeName, fanInKeys));
+      return fanInKeys.at(nodeName);
+    }
+
+    bool hasFanInKey(const std::string& nodeName) const {
+      return contains_key(nodeName, fanInKeys);
+    }
+
+    // -1 for selects created after the template was built
+    int getSelectSlot(CoreIR::Select* const sel) const {
+      auto slot = selectSlots.find(sel);
+      return slot == std::end(selectSlots) ? -1 : slot->second;
+    }
+
+    const std::vector<std::pair<CoreIR::Wireable*, std::vector<int> > >&
+    getSelectPaths() const {
+      return selectPaths;
+    }
+
+    const std::vector<CoreIR::Type::DirKind>& getPortDirections() const {
+      return portDirections;
+    }
+
+    // The select of each interface field on self, in the same order as
+    // getPortDirections
+    const std::vector<CoreIR::Select*>& getPortSelects() const {
+      return portSelects;
+    }
+
+    const InstanceInfo& getInstanceInfo(CoreIR::Instance* const inst) const {
+      assert(contains_key(inst, instanceInfo));
+      return instanceInfo.at(inst);
+    }
 
-          setValue(instR.second->sel("out"), value);
+    OpCode getOpCode(CoreIR::Instance* const inst) const {
+      return getInstanceInfo(inst).op;
+    }
 
-          if (container == nullptr) {
-            std::cout << "\tDone setting const value" << std::endl;
+    template<typename F>
+    const std::vector<CoreIR::Instance*>& getConstantOrder(F findConstants) {
+      std::call_once(constantsFlag, [this, &findConstants]() {
+          constantOrder = findConstants();
+          for (auto inst : constantOrder) {
+            prunedNodes.insert(inst);
           }
-          
-        }
+        });
+      return constantOrder;
+    }
 
-        if (container == nullptr) {
-          std::cout << "Done instance # " << numInitialized << ": " << instR.first << ", type = " << CoreIR::getQualifiedOpName(*(instR.second)) << std::endl;
-        }
-        
-        numInitialized++;
+    const std::vector<CoreIR::Instance*>& getConstants() const {
+      return constantOrder;
+    }
 
+    bool isPruned(CoreIR::Wireable* const node) const {
+      return dbhc::elem(node, prunedNodes);
+    }
+
+    ~ModuleTemplate() {
+      for (auto val : ownedValues) {
+        delete val;
       }
     }
+  };
 
-    EventSimulator* getContainer() const {
-      return container;
+  class ModuleTemplateCache {
+    std::map<CoreIR::Module*, ModuleTemplate*> templates;
+
+    bool pruneDeadLogic;
+    bool aliasWires;
+
+    // Removes and returns the template of mod if its definition is
+    // unchanged, otherwise returns null
+    ModuleTemplate* release(CoreIR::Module* const mod);
+
+  public:
+
+    ModuleTemplateCache(const bool pruneDeadLogic_, const bool aliasWires_) :
+      pruneDeadLogic(pruneDeadLogic_), aliasWires(aliasWires_) {}
+
+    // Builds the template for mod and for every module it instantiates.
+    // Templates in previous whose definitions were not edited are moved
+    // into this cache instead of being rebuilt.
+    ModuleTemplate* build(CoreIR::Module* const mod,
+                          ModuleTemplateCache* const previous = nullptr);
+
+    bool prunesDeadLogic() const { return pruneDeadLogic; }
+    bool aliasesWires() const { return aliasWires; }
+
+    ModuleTemplate* get(CoreIR::Module* const mod) const {
+      assert(contains_key(mod, templates));
+      return templates.at(mod);
     }
 
-    CoreIR::Instance* getInstanceBeingSimulated() const {
-      return instanceBeingSimulated;
+    ~ModuleTemplateCache() {
+      for (auto tmpl : templates) {
+        delete tmpl.second;
+      }
     }
-    
-    WireValue* defaultWireValue(CoreIR::Wireable* const w) {
-      WireValue* val = nullptr;
-      if (w->getType()->getKind() == CoreIR::Type::TK_Record) {
-
-        std::vector<std::pair<std::string, WireValue*> > fields;
-        CoreIR::RecordType* tp = CoreIR::cast<CoreIR::RecordType>(w->getType());
-        for (auto field : tp->getFields()) {
-          fields.push_back({field, defaultWireValue(w->sel(field))});
-        }
-        val = new RecordValue(fields);
-        
-      } else if (CoreIR::isa<CoreIR::ArrayType>(w->getType())) {
+  };
+  
+  class EventSimulator {
+    CoreIR::Module* mod;
 
-        CoreIR::ArrayType* arrTp = CoreIR::cast<CoreIR::ArrayType>(w->getType());
+    std::map<CoreIR::Wireable*, WireValue*> values;
 
-        std::vector<WireValue*> arrValues;
-        for (int i = 0; i < (int) arrTp->getLen(); i++) {
-          arrValues.push_back(defaultWireValue(w->sel(i)));
-        }
-        val = new ArrayValue(arrValues);
+    std::vector<WireValue*> wireValues;
 
-      } else if (isBitType(*(w->getType()))) {
-        val = new BitValue(bsim::quad_value(QBV_UNKNOWN_VALUE));
-      } else if (CoreIR::isa<CoreIR::NamedType>(w->getType())) {
+    // Indexed by InstanceInfo::index
+    std::vector<PortValues> portValues;
 
-        CoreIR::NamedType* tp =
-          CoreIR::cast<CoreIR::NamedType>(w->getType());
-        //std::cout << "ERROR: " << w->toString() << " has unsupported named type " << tp->toString() << " with raw type " << tp->getRaw()->toString() << std::endl;
+    // Storage of every select, indexed by ModuleTemplate::getSelectSlot
+    std::vector<WireValue*> selectValues;
 
-        // Currently we only handle bit types
-        assert(isBitType(*(tp->getRaw())));
+    // Indexed like ModuleTemplate::getRegisterGroups
+    std::vector<RegisterGroupState> registerGroupStates;
+    std::vector<int> edgeGroups;
 
-        val = new BitValue(bsim::quad_value(QBV_UNKNOWN_VALUE));
-        
-        //assert(false);
-      } else {
-        std::cout << "ERROR: Unsupported wireable " << w->toString() << std::endl;
-        assert(false);
-      }
+    // For each signal of this module, the submodules and indices of their
+    // ports that it reaches which feed a register clock inside them. A
+    // change to the signal makes those registers sample before any
+    // instance is evaluated, so registers in a downstream submodule never
+    // see the outputs an upstream one produced on the same edge.
+    std::unordered_map<CoreIR::Select*,
+                       std::vector<std::pair<EventSimulator*, int> > > clockFanOut;
+
+    // Indexed like ModuleTemplate::getPortSelects
+    std::vector<bool> clockInputs;
+    bool anyPresampled;
+
+    // Changes to each output of the last submodule instance evaluated,
+    // in the order of InstanceInfo::outputs
+    std::vector<ChangeMask> outputChanges;
+
+    EventStats stats;
+
+    NodeQueue nodeQueue;
 
-      assert(val != nullptr);
+    // Null unless causality logging is enabled. queuedBy holds, for each
+    // instance index, the net whose change last queued the instance.
+    CausalityLog* causality;
+    std::vector<CoreIR::Select*> queuedBy;
+    uint64_t batchTime;
+    uint32_t batchDelta;
 
-      wireValues.insert(val);
+    void recordChange(CoreIR::Select* const net,
+                      CoreIR::Instance* const cause,
+                      CoreIR::Select* const causeInput);
 
-      return val;
+    // Indexed like ModuleTemplate::getLoops
+    int maxLoopIterations;
+    std::vector<int> loopEvaluations;
+    std::vector<int> activeLoops;
+    std::vector<bool> oscillating;
+
+    std::map<CoreIR::Instance*, EventSimulator*> submodules;
+
+    CoreIR::Instance* instanceBeingSimulated;
+    EventSimulator* container;
+
+    ModuleTemplateCache* templates;
+    ModuleTemplate* tmpl;
+
+    bool twoState;
+    TwoStateOptions twoStateOptions;
+    std::mt19937 unknownValueSource;
+
+    bool foldingEnabled;
+
+    // Nodes that are constant or unobserved once the configuration is
+    // frozen, and receivers on the unselected input of muxes whose select
+    // is part of the frozen configuration
+    std::set<CoreIR::Wireable*> frozenNodes;
+    std::set<CoreIR::Select*> ignoredReceivers;
+
+    // Names passed to observe, and the instances outside their fan-in
+    // cone, which are not evaluated until the observed set widens
+    std::vector<std::string> observedNames;
+    std::set<CoreIR::Wireable*> unobservedNodes;
+
+    bool isSkipped(CoreIR::Wireable* const node) const {
+      return tmpl->isPruned(node) || dbhc::elem(node, frozenNodes) ||
+        dbhc::elem(node, unobservedNodes);
     }
 
-    bool updateInstance(CoreIR::Instance* const inst);
+    void updateObservedCone();
+
+    void makeKnown(WireValue* const value);
+    bsim::quad_value knownValue(const bsim::quad_value v);
+    BitVector knownBits(const BitVector& bv);
+
+    void shareStorage(CoreIR::Select* const receiver, WireValue* const storage);
+    void resolvePortValues();
+    void resolveRegisterGroups();
+    void resolveSchedule();
+    bool withinLoopBound(const int loop);
+    void addOscillatingLoops(const std::string& prefix,
+                             std::vector<std::string>& names) const;
+    void resolveClockFanOut();
+    void sampleGroup(const int group);
+    void presampleClockInput(const int port);
+    void presampleSubmodules(CoreIR::Select* const signal);
+    void clearPresampled();
+    void clockRegisters(const std::vector<int>& groups,
+                        SignalQueue& freshSignals);
+    void scheduleOutputs(CoreIR::Instance* const inst,
+                         const ChangeMask changed,
+                         SignalQueue& freshSignals);
+
+    WireValue* portValue(CoreIR::Select* const port) const {
+      return port == nullptr ? nullptr : getWireValue(port);
+    }
+
+    void setConstantValue(CoreIR::Instance* const inst);
+    bool portIsConstant(CoreIR::Wireable* const node,
+                        const std::string& port,
+                        const std::set<CoreIR::Wireable*>& constants);
+    bool tryFoldInstance(CoreIR::Instance* const inst,
+                         const std::set<CoreIR::Wireable*>& constants);
+    std::vector<CoreIR::Instance*> findConstants();
+    void initializeConstants(const ElaborationCallback& progress,
+                             const bool verbose);
+
+    bool patch();
+    void rebuild(ModuleTemplate* const fresh);
+    void inheritModes(EventSimulator* const sub);
+    void settle(const std::set<CoreIR::Wireable*>& nodes);
+
+    void freeze(const std::string& prefix,
+                const RegisterPredicate& isConfigRegister,
+                const std::set<CoreIR::Select*>& constantInputs);
+    void findInactiveInstances();
+    void clearFrozen();
+
+  public:
+
+    const std::vector<CoreIR::Connection>&
+    allSourceConnections(CoreIR::Wireable* const w) const {
+      return tmpl->getFanIn(w);
+    }
 
+    const std::vector<CoreIR::Select*>&
+    allReceiverSelects(CoreIR::Wireable* const w) const {
+      return tmpl->getFanOut(w);
+    }
+    
+    EventSimulator(CoreIR::Module* const mod_,
+                   const ElaborationOptions& options = ElaborationOptions()) :
+      EventSimulator(mod_, nullptr, nullptr, options) {
+    }
+
+    EventSimulator(CoreIR::Module* const mod_,
+                   CoreIR::Instance* const instanceBeingSimulated_,
+                   EventSimulator* const container_,
+                   const ElaborationOptions& options = ElaborationOptions());
+
+    EventSimulator* getContainer() const {
+      return container;
+    }
+
+    CoreIR::Instance* getInstanceBeingSimulated() const {
+      return instanceBeingSimulated;
+    }
+    
+    WireValue* instantiateWireValue(const WireValue* const proto);
+
+    // Returns the bits of the instance's outputs that changed
+    ChangeMask updateInstance(CoreIR::Instance* const inst);
+
+    void updateSignals(SignalQueue& freshSignals);
+
+    // Propagates changes to every bit of freshSignals
     void updateSignals(std::set<CoreIR::Select*>& freshSignals);
+
+    EventStats getEventStats() const;
+    void resetEventStats();
+
+    // Combinational loops that hit the iteration bound, each as a comma
+    // separated list of $ separated instance names
+    std::vector<std::string> oscillatingLoops() const;
+
+    // Records every change propagated by this simulator and its
+    // submodules in a ring buffer of capacity events per simulator, so
+    // that explain can trace where values came from
+    void enableCausalityLog(const size_t capacity);
+    void disableCausalityLog();
+
+    // Walks back from the newest change to name (in getBitVec's $
+    // separated form) through the events that caused it, until reaching
+    // an input set by the user, a register, a submodule boundary or the
+    // oldest event in the log. The first step is the change to name.
+    std::vector<CausalityStep> explain(const std::string& name) const;
+
+    // Names of the instances of the top module that the instance or port
+    // name depends on, or that depend on it, with "self" standing for the
+    // interface. Answered from the cone index built at elaboration.
+    std::vector<std::string> transitiveDrivers(const std::string& name) const;
+    std::vector<std::string> transitiveLoads(const std::string& name) const;
     
     void setValue(const std::string& name, const BitVector& bv) {
       assert(mod->getDef()->canSel(name));
@@ -360,20 +1130,67 @@ namespace EventSim {
       WireValue* v = getWireValue(s);
       assert(v != nullptr);
 
-      //std::cout << "Setting value of " << s->toString() << " to " << bv << std::endl;
       setWireBitVector(bv, *v);
+
+      if (twoState) {
+        makeKnown(v);
+      }
     }
 
-    void setValue(CoreIR::Wireable* const s, const BitVector& bv) {
-      setValueNoUpdate(s, bv);
+    // Sets s to bv and returns the bits of its port that changed
+    ChangeMask setInputNoUpdate(CoreIR::Select* const s, const BitVector& bv) {
+      WireValue* v = getWireValue(s);
+      assert(v != nullptr);
+
+      // Unknown bits are replaced before writing, so the mask only holds
+      // bits whose two state value moved
+      ChangeMask changed =
+        twoState ? updateWireBitVector(knownBits(bv), *v) :
+        updateWireBitVector(bv, *v);
+
+      if (s->getParent() != s->getTopParent()) {
+        return changed == 0 ? 0 : ALL_BITS_CHANGED;
+      }
+
+      return changed;
+    }
+
+    // Resolves the select for name once, so that callers setting the
+    // same inputs many times do not look it up on every call
+    CoreIR::Select* getInputHandle(const std::string& name) {
+      assert(mod->getDef()->canSel(name));
+      CoreIR::Wireable* s = mod->getDef()->sel(name);
+
+      assert(CoreIR::isa<CoreIR::Select>(s));
+      return CoreIR::cast<CoreIR::Select>(s);
+    }
 
+    // Like getInputHandle, but null if name is not a select of this module
+    CoreIR::Select* findInputHandle(const std::string& name) {
+      if (!mod->getDef()->canSel(name)) {
+        return nullptr;
+      }
+
+      CoreIR::Wireable* s = mod->getDef()->sel(name);
+      return CoreIR::isa<CoreIR::Select>(s) ? CoreIR::cast<CoreIR::Select>(s) : nullptr;
+    }
+
+    // Writes words[i] to inputs[i], each at most 64 bits wide, and then
+    // propagates every change together like setValues
+    void setWords(const std::vector<CoreIR::Select*>& inputs,
+                  const uint64_t* const words);
+
+    void setValue(CoreIR::Wireable* const s, const BitVector& bv) {
       CoreIR::Select* sel = CoreIR::cast<CoreIR::Select>(s);
-      std::set<CoreIR::Select*> freshSignals;
-      freshSignals.insert(sel);
 
-      
+      SignalQueue freshSignals;
+      ChangeMask changed = setInputNoUpdate(sel, bv);
+      if (changed != 0) {
+        freshSignals.push(sel, changed);
+        recordChange(sel, nullptr, nullptr);
+      }
+
       updateSignals(freshSignals);
-      
     }
     
     WireValue* selectField(const std::string& selStr,
@@ -406,6 +1223,13 @@ namespace EventSim {
     }
     
     WireValue* getWireValue(CoreIR::Wireable* const w) const {
+      if (CoreIR::isa<CoreIR::Select>(w)) {
+        int slot = tmpl->getSelectSlot(CoreIR::cast<CoreIR::Select>(w));
+        if ((slot >= 0) && (slot < ((int) selectValues.size()))) {
+          return selectValues[slot];
+        }
+      }
+
       if (!CoreIR::isa<CoreIR::Select>(w)) {
         if (!contains_key(w, values)) {
           std::cout << "ERROR: Cannot find " << w->toString() << std::endl;
@@ -437,59 +1261,98 @@ namespace EventSim {
     }
 
     BitVector getBitVec(const std::string& name) {
+      return extractBitVector(*getValueHandle(name));
+    }
+
+    // Storage of the wire that getBitVec(name) reads. Handles stay valid
+    // until the simulator is re-elaborated.
+    const WireValue* getValueHandle(const std::string& name) {
+      const WireValue* value = findValueHandle(name);
+      if (value == nullptr) {
+        std::cout << "ERROR: Cannot find " << name << std::endl;
+      }
+      assert(value != nullptr);
+
+      return value;
+    }
+
+    // Like getValueHandle, but null if name does not exist
+    const WireValue* findValueHandle(const std::string& name) {
 
       CoreIR::SelectPath paths = CoreIR::splitString<CoreIR::SelectPath>(name, '$');
-      assert(paths.size() >= 1);
+      if (paths.size() < 1) {
+        return nullptr;
+      }
 
-      int pathInd = 0;
+      size_t pathInd = 0;
       EventSimulator* sim = this;
       while (pathInd < (paths.size() - 1)) {
-        auto subInstance = sim->mod->getDef()->getInstances().at(paths[pathInd]);
-
-        assert(contains_key(subInstance, sim->submodules));
+        const auto& instances = sim->mod->getDef()->getInstances();
+        auto subInstance = instances.find(paths[pathInd]);
+        if ((subInstance == std::end(instances)) ||
+            !contains_key(subInstance->second, sim->submodules)) {
+          return nullptr;
+        }
 
-        sim = sim->submodules[subInstance];
+        sim = sim->submodules[subInstance->second];
         pathInd++;
       }
 
-      assert(sim->mod->getDef()->canSel(paths.back()));
+      if (!sim->mod->getDef()->canSel(paths.back())) {
+        return nullptr;
+      }
       
       CoreIR::Wireable* w = sim->mod->getDef()->sel(paths.back());
 
-      return sim->getBitVec(w);
-        
+      return sim->getWireValue(w);
     }
 
     void updateInputs(CoreIR::Wireable* const inst);
 
-    template<typename F>
-    bool updateBinopNode(CoreIR::Instance* const inst, F f) {
-      CoreIR::BitVec oldOut = getBitVec(inst->sel("out"));
-      updateInputs(inst);
-
-      CoreIR::BitVec in0 = getBitVec(inst->sel("in0"));
-      CoreIR::BitVec in1 = getBitVec(inst->sel("in1"));
+    // Copies the values of driving ports into the inputs of inst
+    void updateInputs(const PortValues& ports) {
+      for (auto& copy : ports.copies) {
+        copyWireValueOver(copy.first, copy.second);
+      }
+    }
 
-      CoreIR::BitVec res = f(in0, in1);
+    // f computes the result on four state bit vectors and fw on the
+    // operands as integers. fw is used whenever neither operand has an x or
+    // z bit, so that case never allocates; other operands go through four
+    // state BitVecs.
+    template<typename F, typename FW>
+    ChangeMask updateBinopNode(const PortValues& ports, F f, FW fw) {
+      updateInputs(ports);
+
+      const WireValue* in0 = ports.in0;
+      const WireValue* in1 = ports.in1;
+      WireValue* out = ports.out;
+
+      uint64_t l, r;
+      if (readKnownWord(*in0, l) && readKnownWord(*in1, r)) {
+        return writeWord(fw(l, r, bitWidth(*in0)), *out);
+      }
 
-      setValueNoUpdate(inst->sel("out"), res);
+      CoreIR::BitVec res = f(extractBitVector(*in0), extractBitVector(*in1));
 
-      return !same_representation(res, oldOut);
+      return updateWireBitVector(res, *out);
     }
 
-    template<typename F>
-    bool updateUnopNode(CoreIR::Instance* const inst, F f) {
-      CoreIR::BitVec oldOut = getBitVec(inst->sel("out"));
-
-      updateInputs(inst);
+    template<typename F, typename FW>
+    ChangeMask updateUnopNode(const PortValues& ports, F f, FW fw) {
+      updateInputs(ports);
 
-      CoreIR::BitVec in0 = getBitVec(inst->sel("in"));
+      const WireValue* in = ports.in;
+      WireValue* out = ports.out;
 
-      CoreIR::BitVec res = f(in0);
+      uint64_t a;
+      if (readKnownWord(*in, a)) {
+        return writeWord(fw(a, bitWidth(*in)), *out);
+      }
 
-      setValueNoUpdate(inst->sel("out"), res);
+      CoreIR::BitVec res = f(extractBitVector(*in));
 
-      return !same_representation(res, oldOut);
+      return updateWireBitVector(res, *out);
     }
     
     ~EventSimulator() {
@@ -500,6 +1363,12 @@ namespace EventSim {
       for (auto mod : submodules) {
         delete mod.second;
       }
+
+      if (container == nullptr) {
+        delete templates;
+      }
+
+      delete causality;
     }
 
     std::map<CoreIR::Select*, CoreIR::BitVec>
@@ -510,6 +1379,74 @@ namespace EventSim {
     void printInstances(const std::string& instanceName);
 
     void setValues(const std::vector<std::pair<std::string, CoreIR::BitVec> >& values);
+
+    // Two state mode replaces every x and z bit in the design according to
+    // options.policy and re-settles all logic, after which every operator
+    // takes its integer path. Returns false, leaving the simulator in four
+    // state mode, if options.requireKnownRegisters is set and some register
+    // is not known.
+    bool enterTwoStateMode(const TwoStateOptions& options = TwoStateOptions());
+
+    void exitTwoStateMode();
+
+    bool isTwoState() const { return twoState; }
+
+    // Names (in getBitVec's $ separated form) of registers whose output
+    // has an x or z bit
+    std::vector<std::string> unknownRegisters();
+
+    // Appends every bit of storage in this simulator and its submodules,
+    // in an order that only depends on the module definitions. Used to
+    // save and restore simulator state.
+    void collectBits(std::vector<BitValue*>& bits);
+
+    // Recomputes state derived from storage, such as the last value seen
+    // on each clock, after every bit has been overwritten
+    void restoreDerivedState();
+
+    // Evaluates every instance in the hierarchy and propagates the results
+    void reevaluateAll();
+
+    // Treats the chosen registers as constants, for example the
+    // configuration registers of a CGRA once the bitstream is loaded.
+    // Logic that then only depends on constants is never evaluated again,
+    // muxes whose select is constant ignore changes on their unselected
+    // input, and combinational logic that only feeds ignored inputs is
+    // removed. Constant inputs of submodules are propagated into them.
+    void freezeConfiguration(const RegisterPredicate& isConfigRegister);
+    void freezeConfiguration(const std::vector<std::string>& configRegisters);
+
+    // Returns to evaluating every node and re-settles the design, which is
+    // needed before loading a new configuration.
+    void unfreezeConfiguration();
+
+    // Number of nodes in the hierarchy skipped due to frozen configuration
+    int numFrozenNodes() const;
+
+    // Evaluates only the transitive fan-in of the named outputs and
+    // registers, in getBitVec's $ separated form, across clock cycles.
+    // Later calls widen the observed set and settle the nodes that enter
+    // it. A name inside a submodule observes the whole submodule. Values
+    // outside the cone go stale, and registers that enter it keep the
+    // state they had when they left it. Returns false without changing
+    // the observed set if any name is not in the design.
+    bool observe(const std::vector<std::string>& names);
+
+    // Returns to evaluating every node
+    void observeAll();
+
+    // Number of instances of the top level module outside the cone
+    int numUnobservedNodes() const { return unobservedNodes.size(); }
+
+    // Brings a top level simulator up to date after instances or
+    // connections anywhere in the hierarchy were added or removed, for
+    // example by running passes. Modules whose definitions were not edited
+    // keep their templates and storage. In edited modules, instances that
+    // are still present under the same name and module keep their values,
+    // including register state, and only new instances, nodes whose
+    // connections changed and their fan-out are re-evaluated. Frozen
+    // configuration is dropped. Returns false if nothing was edited.
+    bool reelaborate();
   };
 
   std::map<CoreIR::Select*, CoreIR::BitVec>
@@ -0,0 +1,155 @@
+#include "snapshot.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace EventSim {
+
+  static const char SNAPSHOT_MAGIC[4] = {'E', 'S', 'S', 'N'};
+
+  // Bump whenever the header or the order of collectBits changes
+  static const uint32_t SNAPSHOT_VERSION = 1;
+
+  // Followed by one byte per bit, holding the bit's quad value
+  struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t numBits;
+  };
+
+  static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+  static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+  static void fnvHash(uint64_t& hash, const char* data, const size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      hash ^= (unsigned char) data[i];
+      hash *= FNV_PRIME;
+    }
+  }
+
+  // Strings are hashed with their terminator so that ("ab", "c") and
+  // ("a", "bc") get different keys
+  static void fnvHash(uint64_t& hash, const std::string& str) {
+    fnvHash(hash, str.c_str(), str.size() + 1);
+  }
+
+  uint64_t snapshotKey(const std::string& jsonFile,
+                       const std::string& topModule,
+                       const std::vector<std::string>& passes) {
+    ifstream in(jsonFile, ios::binary);
+    string contents((istreambuf_iterator<char>(in)),
+                    istreambuf_iterator<char>());
+
+    uint64_t hash = FNV_OFFSET_BASIS;
+    fnvHash(hash, contents);
+    fnvHash(hash, topModule);
+    for (auto& pass : passes) {
+      fnvHash(hash, pass);
+    }
+
+    return hash;
+  }
+
+  static unsigned char encodeBit(const bsim::quad_value value) {
+    if (value.is_binary()) {
+      return value.binary_value();
+    } else if (value.is_unknown()) {
+      return QBV_UNKNOWN_VALUE;
+    }
+
+    assert(value.is_high_impedance());
+    return QBV_HIGH_IMPEDANCE_VALUE;
+  }
+
+  bool saveSnapshot(EventSimulator& sim,
+                    const std::string& path,
+                    const uint64_t key) {
+    vector<BitValue*> bits;
+    sim.collectBits(bits);
+
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.key = key;
+    header.numBits = bits.size();
+
+    vector<unsigned char> body(bits.size());
+    for (int i = 0; i < (int) bits.size(); i++) {
+      body[i] = encodeBit(bits[i]->value());
+    }
+
+    ofstream out(path, ios::binary | ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(body.data()), body.size());
+
+    if (!out) {
+      if (logEnabled(LOG_LEVEL_ERROR)) {
+        logMessage(LOG_LEVEL_ERROR, "ERROR: Could not write snapshot " + path);
+      }
+      return false;
+    }
+
+    return true;
+  }
+
+  bool loadSnapshot(EventSimulator& sim,
+                    const std::string& path,
+                    const uint64_t key) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat info;
+    if ((fstat(fd, &info) != 0) ||
+        (info.st_size < (off_t) sizeof(SnapshotHeader))) {
+      close(fd);
+      return false;
+    }
+
+    size_t size = info.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+      return false;
+    }
+
+    const SnapshotHeader* header = static_cast<const SnapshotHeader*>(data);
+    const unsigned char* body =
+      static_cast<const unsigned char*>(data) + sizeof(SnapshotHeader);
+
+    vector<BitValue*> bits;
+    sim.collectBits(bits);
+
+    bool matches =
+      (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0) &&
+      (header->version == SNAPSHOT_VERSION) &&
+      (header->key == key) &&
+      (header->numBits == bits.size()) &&
+      (size == sizeof(SnapshotHeader) + bits.size());
+
+    if (matches) {
+      for (int i = 0; i < (int) bits.size(); i++) {
+        bits[i]->setValue(bsim::quad_value(body[i]));
+      }
+      sim.restoreDerivedState();
+    } else if (logEnabled(LOG_LEVEL_INFO)) {
+      logMessage(LOG_LEVEL_INFO, "Snapshot " + path + " is stale, ignoring it");
+    }
+
+    munmap(data, size);
+
+    return matches;
+  }
+
+}
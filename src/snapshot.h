@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "simulator.h"
+
+namespace EventSim {
+
+  // State snapshots store the value of every bit of a simulator so that a
+  // run can resume from a configured state without clocking the bitstream
+  // in again. They are not a cache of the elaborated simulator: the JSON
+  // must still be loaded, the passes run and the simulator elaborated
+  // before a snapshot is loaded into it, so startup time is unchanged. The
+  // key identifies the inputs the simulator was built from, and snapshots
+  // taken from different inputs are rejected.
+
+  // FNV-1a hash of the contents of the JSON file, the top module name and
+  // the passes run on the context
+  uint64_t snapshotKey(const std::string& jsonFile,
+                       const std::string& topModule,
+                       const std::vector<std::string>& passes);
+
+  bool saveSnapshot(EventSimulator& sim,
+                    const std::string& path,
+                    const uint64_t key);
+
+  // Returns false, leaving sim unchanged, if the file is missing, was
+  // written by a different snapshot version or for a different key or
+  // module hierarchy
+  bool loadSnapshot(EventSimulator& sim,
+                    const std::string& path,
+                    const uint64_t key);
+
+}
@@ -0,0 +1,212 @@
+#include "stimulus.h"
+
+#include <cstddef>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace CoreIR;
+using namespace std;
+
+namespace EventSim {
+
+  static const char STIMULUS_MAGIC[4] = {'E', 'S', 'S', 'T'};
+  static const uint32_t STIMULUS_VERSION = 1;
+
+  // Followed by numPorts (name length, name, width) entries
+  struct StimulusHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t numCycles;
+    uint32_t numPorts;
+    uint32_t reserved;
+  };
+
+  StimulusWriter::StimulusWriter(const std::string& path,
+                                 const std::vector<StimulusPort>& ports) :
+    out(path, ios::binary | ios::trunc),
+    numCycles(0),
+    numPorts(ports.size()) {
+
+    if (!out.is_open()) {
+      if (logEnabled(LOG_LEVEL_ERROR)) {
+        logMessage(LOG_LEVEL_ERROR, "ERROR: Could not open stimulus file " + path);
+      }
+      return;
+    }
+
+    StimulusHeader header;
+    memcpy(header.magic, STIMULUS_MAGIC, sizeof(STIMULUS_MAGIC));
+    header.version = STIMULUS_VERSION;
+    header.numCycles = 0;
+    header.numPorts = ports.size();
+    header.reserved = 0;
+
+    numCyclesPos = offsetof(StimulusHeader, numCycles);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    uint64_t written = sizeof(header);
+    for (auto& port : ports) {
+      assert(port.width <= 64);
+
+      uint32_t nameLength = port.name.size();
+      uint32_t width = port.width;
+      out.write(reinterpret_cast<const char*>(&nameLength), sizeof(nameLength));
+      out.write(port.name.c_str(), nameLength);
+      out.write(reinterpret_cast<const char*>(&width), sizeof(width));
+      written += sizeof(nameLength) + nameLength + sizeof(width);
+    }
+
+    // Cycles start on a word boundary so the player can read them in place
+    const char padding[8] = {0};
+    out.write(padding, (8 - (written % 8)) % 8);
+  }
+
+  void StimulusWriter::writeCycle(const std::vector<uint64_t>& words) {
+    assert(isOpen());
+    assert(((int) words.size()) == numPorts);
+
+    out.write(reinterpret_cast<const char*>(words.data()),
+              words.size() * sizeof(uint64_t));
+    numCycles++;
+  }
+
+  void StimulusWriter::close() {
+    if (!out.is_open()) {
+      return;
+    }
+
+    out.seekp(numCyclesPos);
+    out.write(reinterpret_cast<const char*>(&numCycles), sizeof(numCycles));
+    out.close();
+  }
+
+  bool isBinaryStimulus(const std::string& path) {
+    ifstream in(path, ios::binary);
+    char magic[4];
+    if (!in.read(magic, sizeof(magic))) {
+      return false;
+    }
+    return memcmp(magic, STIMULUS_MAGIC, sizeof(STIMULUS_MAGIC)) == 0;
+  }
+
+  StimulusPlayer::StimulusPlayer(EventSimulator& sim_,
+                                 const std::string& path) :
+    sim(sim_), data(nullptr), size(0), cycles(nullptr), numCycles(0) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+
+    struct stat info;
+    if ((fstat(fd, &info) != 0) ||
+        (info.st_size < (off_t) sizeof(StimulusHeader))) {
+      close(fd);
+      return;
+    }
+
+    size_t fileSize = info.st_size;
+    void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+      return;
+    }
+
+    const char* bytes = static_cast<const char*>(mapped);
+    const StimulusHeader* header = static_cast<const StimulusHeader*>(mapped);
+
+    bool valid =
+      (memcmp(header->magic, STIMULUS_MAGIC, sizeof(STIMULUS_MAGIC)) == 0) &&
+      (header->version == STIMULUS_VERSION);
+
+    size_t pos = sizeof(StimulusHeader);
+    for (uint32_t i = 0; valid && (i < header->numPorts); i++) {
+      uint32_t nameLength = 0;
+      uint32_t width = 0;
+
+      valid = pos + sizeof(nameLength) <= fileSize;
+      if (!valid) {
+        break;
+      }
+      memcpy(&nameLength, bytes + pos, sizeof(nameLength));
+      pos += sizeof(nameLength);
+
+      valid = pos + nameLength + sizeof(width) <= fileSize;
+      if (!valid) {
+        break;
+      }
+      string name(bytes + pos, nameLength);
+      pos += nameLength;
+      memcpy(&width, bytes + pos, sizeof(width));
+      pos += sizeof(width);
+
+      ports.push_back({name, (int) width});
+    }
+
+    pos += (8 - (pos % 8)) % 8;
+
+    // Divides instead of multiplying so a corrupt cycle count cannot wrap
+    // around and pass the check
+    uint64_t cycleBytes = ((uint64_t) header->numPorts) * sizeof(uint64_t);
+    valid = valid && (pos <= fileSize) &&
+      ((cycleBytes == 0) || (header->numCycles <= (fileSize - pos) / cycleBytes));
+
+    if (!valid) {
+      if (logEnabled(LOG_LEVEL_ERROR)) {
+        logMessage(LOG_LEVEL_ERROR, "ERROR: Malformed stimulus file " + path);
+      }
+      munmap(mapped, fileSize);
+      ports.clear();
+      return;
+    }
+
+    for (auto& port : ports) {
+      Select* handle = sim.findInputHandle(port.name);
+      if (handle == nullptr) {
+        if (logEnabled(LOG_LEVEL_ERROR)) {
+          logMessage(LOG_LEVEL_ERROR, "ERROR: Unknown stimulus port " + port.name +
+                     " in " + path);
+        }
+        valid = false;
+        break;
+      }
+
+      int width = bitWidth(*sim.getValueHandle(port.name));
+      if ((port.width != width) || (width > 64)) {
+        if (logEnabled(LOG_LEVEL_ERROR)) {
+          logMessage(LOG_LEVEL_ERROR, "ERROR: Stimulus port " + port.name +
+                     " is " + to_string(port.width) + " bits wide in " + path +
+                     " but " + to_string(width) + " bits wide in the design");
+        }
+        valid = false;
+        break;
+      }
+
+      handles.push_back(handle);
+    }
+
+    if (!valid) {
+      munmap(mapped, fileSize);
+      ports.clear();
+      handles.clear();
+      return;
+    }
+
+    data = mapped;
+    size = fileSize;
+    cycles = reinterpret_cast<const uint64_t*>(bytes + pos);
+    numCycles = header->numCycles;
+  }
+
+  StimulusPlayer::~StimulusPlayer() {
+    if (data != nullptr) {
+      munmap(data, size);
+    }
+  }
+
+}
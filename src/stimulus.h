@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "simulator.h"
+
+namespace EventSim {
+
+  // Binary stimulus files declare a list of input ports and hold one
+  // packed 64 bit word per port for every cycle:
+  //
+  //   header | port names and widths | padding to 8 bytes | cycles
+  //
+  // Each cycle is numPorts consecutive words, so a player reads cycles in
+  // order without parsing anything.
+
+  struct StimulusPort {
+    std::string name;
+    int width;
+  };
+
+  class StimulusWriter {
+    std::ofstream out;
+    std::streampos numCyclesPos;
+    uint64_t numCycles;
+    int numPorts;
+
+  public:
+
+    // Ports may be at most 64 bits wide
+    StimulusWriter(const std::string& path,
+                   const std::vector<StimulusPort>& ports);
+
+    ~StimulusWriter() { close(); }
+
+    bool isOpen() const { return out.is_open(); }
+
+    // words holds one value per declared port
+    void writeCycle(const std::vector<uint64_t>& words);
+
+    // Records the number of cycles written in the header
+    void close();
+  };
+
+  // True if path starts with the magic number of a binary stimulus file
+  bool isBinaryStimulus(const std::string& path);
+
+  class StimulusPlayer {
+    EventSimulator& sim;
+
+    void* data;
+    size_t size;
+
+    std::vector<StimulusPort> ports;
+    std::vector<CoreIR::Select*> handles;
+    const uint64_t* cycles;
+    uint64_t numCycles;
+
+  public:
+
+    // Maps the file and resolves every declared port in sim. isOpen is
+    // false if the file is missing or malformed, or declares a port that
+    // sim does not have or with a different width.
+    StimulusPlayer(EventSimulator& sim_, const std::string& path);
+
+    ~StimulusPlayer();
+
+    bool isOpen() const { return data != nullptr; }
+
+    int getNumCycles() const { return numCycles; }
+
+    const std::vector<StimulusPort>& getPorts() const { return ports; }
+
+    // Sets every declared port to its value in cycle and propagates the
+    // changes together
+    void applyCycle(const int cycle) {
+      assert(isOpen());
+      assert((0 <= cycle) && (((uint64_t) cycle) < numCycles));
+
+      sim.setWords(handles, cycles + ((uint64_t) cycle) * ports.size());
+    }
+  };
+
+}
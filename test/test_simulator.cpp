@@ -2,60 +2,43 @@
 
 #include "catch.hpp"
 
+#include "bitstream.h"
+#include "recorder.h"
 #include "simulator.h"
+#include "snapshot.h"
+#include "stimulus.h"
 #include "coreir/libs/rtlil.h"
 #include "coreir/libs/commonlib.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+
 using namespace CoreIR;
 using namespace std;
 
-namespace EventSim {
-
-  std::vector<std::pair<unsigned int, unsigned int> >
-  loadBitStream(const std::string& fileName) {
-    //std::ifstream t("./test/hwmaster_pw2_sixteen.bsa");
-    std::ifstream t(fileName);
-    std::string configBits((std::istreambuf_iterator<char>(t)),
-                           std::istreambuf_iterator<char>());
-
-    std::vector<std::string> strings;
-
-    std::string::size_type pos = 0;
-    std::string::size_type prev = 0;
-    char delimiter = '\n';
-    string str = configBits;
-    while ((pos = str.find(delimiter, prev)) != std::string::npos) {
-      strings.push_back(str.substr(prev, pos - prev));
-      prev = pos + 1;
-    }
-
-    // To get the last substring (or only, if delimiter is not found)
-    strings.push_back(str.substr(prev));
-
-    vector<pair<unsigned int, unsigned int> > configValues;
-    cout << "Config lines" << endl;
-    for (int i = 0; i < strings.size(); i++) {
-      cout << strings[i] << endl;
+// Every heap allocation made by the test binary
+static std::atomic<long> numAllocations(0);
 
-      string addrStr = strings[i].substr(0, 8);
+void* operator new(std::size_t size) {
+  numAllocations++;
 
-      unsigned int configAddr;
-      std::stringstream ss;
-      ss << std::hex << addrStr;
-      ss >> configAddr;
-
-      string dataStr = strings[i].substr(9, 18);
-
-      unsigned int configData;
-      std::stringstream ss2;
-      ss2 << std::hex << dataStr;
-      ss2 >> configData;
+  void* p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
 
-      configValues.push_back({configAddr, configData});
-    }
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
 
-    return configValues;
-  }
+namespace EventSim {
 
   TEST_CASE("Compare to constant") {
     Context* c = newContext();
@@ -103,6 +86,206 @@ namespace EventSim {
   }
 
 
+  TEST_CASE("Elaboration progress is reported through a callback") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+    
+    Type* cmpConstNType = c->Record({
+        {"in", c->BitIn()},
+          {"out", c->Bit()}
+      });
+
+    Module* cmpConstN = g->newModuleDecl("cmpConstN", cmpConstNType);
+    ModuleDef* def = cmpConstN->newModuleDef();
+
+    Wireable* self = def->sel("self");
+    Wireable* cmp = def->addInstance("eq0", "coreir.eq", {{"width", Const::make(c, 1)}});
+    Wireable* c0 = def->addInstance("c0", "corebit.const", {{"value", Const::make(c,true)}});
+    
+    def->connect(self->sel("in"), cmp->sel("in0")->sel(0));
+    def->connect(c0->sel("out"), cmp->sel("in1")->sel(0));
+    def->connect(cmp->sel("out"), self->sel("out"));
+
+    cmpConstN->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    vector<string> logged;
+    setLogSink([&logged](const LogLevel level, const std::string& msg) {
+        logged.push_back(msg);
+      });
+
+    int valuesDone = 0;
+    int constantsDone = 0;
+    ElaborationOptions options;
+    options.progress = [&valuesDone, &constantsDone](const ElaborationPhase phase,
+                                                     const int numDone,
+                                                     const int numInstances,
+                                                     Instance* const inst) {
+      REQUIRE(numInstances == 2);
+      if (phase == ELABORATION_PHASE_VALUES) {
+        valuesDone = numDone;
+      } else {
+        constantsDone = numDone;
+      }
+    };
+
+    EventSimulator state(cmpConstN, options);
+
+    resetLogSink();
+
+    REQUIRE(valuesDone == 2);
+    REQUIRE(constantsDone == 2);
+    REQUIRE(logged.size() == 0);
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Dead logic is only pruned when asked for") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    Type* deadType = c->Record({
+        {"a", c->BitIn()},
+          {"out", c->Bit()}
+      });
+
+    Module* dead = g->newModuleDecl("deadNot", deadType);
+    ModuleDef* def = dead->newModuleDef();
+
+    def->addInstance("not0", c->getModule("corebit.not"));
+    def->addInstance("unloaded", c->getModule("corebit.not"));
+
+    def->connect("self.a", "not0.in");
+    def->connect("not0.out", "self.out");
+    def->connect("self.a", "unloaded.in");
+
+    dead->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator full(dead);
+    full.setValue("self.a", BitVec(1, 1));
+
+    REQUIRE(full.getBitVec("unloaded.out") == BitVec(1, 0));
+
+    ElaborationOptions options;
+    options.pruneDeadLogic = true;
+    EventSimulator pruned(dead, options);
+    pruned.setValue("self.a", BitVec(1, 1));
+
+    REQUIRE(pruned.getBitVec("self.out") == BitVec(1, 0));
+    REQUIRE(!isKnown(*pruned.getValueHandle("unloaded.out")));
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Constant folding through muxes and ands") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    uint width = 4;
+
+    Type* foldType = c->Record({
+        {"a", c->Array(width, c->BitIn())},
+          {"andOut", c->Array(width, c->Bit())},
+            {"muxOut", c->Array(width, c->Bit())}
+      });
+
+    Module* fold = g->newModuleDecl("fold", foldType);
+    ModuleDef* def = fold->newModuleDef();
+
+    def->addInstance("zero", "coreir.const",
+                     {{"width", Const::make(c, width)}},
+                     {{"value", Const::make(c, BitVector(width, 0))}});
+    def->addInstance("five", "coreir.const",
+                     {{"width", Const::make(c, width)}},
+                     {{"value", Const::make(c, BitVector(width, 5))}});
+    def->addInstance("one", "corebit.const", {{"value", Const::make(c, true)}});
+    def->addInstance("and0", "coreir.and", {{"width", Const::make(c, width)}});
+    def->addInstance("mux0", "coreir.mux", {{"width", Const::make(c, width)}});
+
+    def->connect("self.a", "and0.in0");
+    def->connect("zero.out", "and0.in1");
+    def->connect("and0.out", "self.andOut");
+
+    def->connect("one.out", "mux0.sel");
+    def->connect("self.a", "mux0.in0");
+    def->connect("five.out", "mux0.in1");
+    def->connect("mux0.out", "self.muxOut");
+
+    fold->setDef(def);
+
+    c->runPasses({"rungenerators", "flatten", "flattentypes"});
+
+    EventSimulator state(fold);
+
+    REQUIRE(state.getBitVec("self.andOut") == BitVec(width, 0));
+    REQUIRE(state.getBitVec("self.muxOut") == BitVec(width, 5));
+
+    state.setValue("self.a", BitVec(width, 3));
+
+    REQUIRE(state.getBitVec("self.andOut") == BitVec(width, 0));
+    REQUIRE(state.getBitVec("self.muxOut") == BitVec(width, 5));
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Connected wires share storage") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    uint width = 8;
+
+    Type* notAndType = c->Record({
+        {"a", c->Array(width, c->BitIn())},
+          {"b", c->Array(width, c->BitIn())},
+            {"out", c->Array(width, c->Bit())}
+      });
+
+    Module* notAnd = g->newModuleDecl("notAnd", notAndType);
+    ModuleDef* def = notAnd->newModuleDef();
+
+    Wireable* not0 =
+      def->addInstance("not0", "coreir.not", {{"width", Const::make(c, width)}});
+    Wireable* and0 =
+      def->addInstance("and0", "coreir.and", {{"width", Const::make(c, width)}});
+
+    def->connect("self.a", "not0.in");
+    def->connect("not0.out", "and0.in0");
+    def->connect("self.b", "and0.in1");
+    def->connect("and0.out", "self.out");
+
+    notAnd->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    ElaborationOptions copying;
+    copying.aliasWires = false;
+
+    EventSimulator aliased(notAnd);
+    EventSimulator copied(notAnd, copying);
+
+    Wireable* self = def->sel("self");
+
+    REQUIRE(aliased.getWireValue(and0->sel("in0")) ==
+            aliased.getWireValue(not0->sel("out")));
+    REQUIRE(aliased.getWireValue(self->sel("out")) ==
+            aliased.getWireValue(and0->sel("out")));
+    REQUIRE(copied.getWireValue(and0->sel("in0")) !=
+            copied.getWireValue(not0->sel("out")));
+
+    for (auto sim : {&aliased, &copied}) {
+      sim->setValue("self.a", BitVec(width, 0x0f));
+      sim->setValue("self.b", BitVec(width, 0x3c));
+    }
+
+    REQUIRE(aliased.getBitVec("self.out") == BitVec(width, 0x30));
+    REQUIRE(aliased.getBitVec("self.out") == copied.getBitVec("self.out"));
+
+    deleteContext(c);
+  }
+
   TEST_CASE("D flip flop") {
     Context* c = newContext();
     Namespace* common = CoreIRLoadLibrary_commonlib(c);
@@ -155,93 +338,972 @@ namespace EventSim {
     deleteContext(c);
   }
   
-  TEST_CASE("andr") {
+  TEST_CASE("Registers on the same clock sample before updating") {
     Context* c = newContext();
+    CoreIRLoadLibrary_commonlib(c);
+
     Namespace* g = c->getGlobal();
-    
-    uint n = 11;
 
-    Generator* andr = c->getGenerator("coreir.andr");
-    Type* andrNType = c->Record({
-        {"in", c->Array(n, c->BitIn())},
-          {"out", c->Bit()}
+    Type* shiftType = c->Record({
+        {"IN", c->BitIn()},
+          {"CLK", c->Named("coreir.clkIn")},
+            {"OUT", c->Bit()}
       });
 
-    Module* andrN = g->newModuleDecl("andrN", andrNType);
-    ModuleDef* def = andrN->newModuleDef();
+    Module* shiftTest = g->newModuleDecl("shiftTest", shiftType);
+    ModuleDef* def = shiftTest->newModuleDef();
 
-    Wireable* self = def->sel("self");
-    Wireable* andr0 = def->addInstance("andr0", andr, {{"width", Const::make(c,n)}});
-    
-    def->connect(self->sel("in"), andr0->sel("in"));
-    def->connect(andr0->sel("out"),self->sel("out"));
+    def->addInstance("r0",
+                     c->getModule("corebit.reg"),
+                     {{"init", Const::make(c, false)}});
+    def->addInstance("r1",
+                     c->getModule("corebit.reg"),
+                     {{"init", Const::make(c, false)}});
 
-    andrN->setDef(def);
+    def->connect("self.IN", "r0.in");
+    def->connect("r0.out", "r1.in");
+    def->connect("self.CLK", "r0.clk");
+    def->connect("self.CLK", "r1.clk");
+    def->connect("r1.out", "self.OUT");
+
+    shiftTest->setDef(def);
 
     c->runPasses({"rungenerators","flattentypes","flatten"});
 
-    EventSimulator state(andrN);
+    EventSimulator state(shiftTest);
 
-    SECTION("Bitvector that is all ones") {
-      state.setValue("self.in", BitVec(n, "11111111111"));
+    state.setValue("self.IN", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 1));
+    state.setValue("self.CLK", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 1));
 
-      SECTION("Input is actually set") {
-        REQUIRE(state.getBitVec("self.in") == BitVec(n, "11111111111"));
-      }
+    REQUIRE(state.getBitVec("self.OUT") == BitVec(1, 0));
 
-      REQUIRE(state.getBitVec("self.out") == BitVec(1, 1));
+    state.setValue("self.IN", BitVec(1, 1));
+    state.setValue("self.CLK", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("r0.out") == BitVec(1, 1));
+    REQUIRE(state.getBitVec("self.OUT") == BitVec(1, 0));
+
+    state.setValue("self.CLK", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("self.OUT") == BitVec(1, 1));
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Restoring a snapshot of register state") {
+    Context* c = newContext();
+    CoreIRLoadLibrary_commonlib(c);
+
+    Namespace* g = c->getGlobal();
+
+    Type* dffType = c->Record({
+        {"IN", c->BitIn()},
+          {"CLK", c->Named("coreir.clkIn")},
+            {"OUT", c->Bit()}
+      });
+
+    Module* dffTest = g->newModuleDecl("dffTest", dffType);
+    ModuleDef* def = dffTest->newModuleDef();
+
+    def->addInstance("dff0",
+                     c->getModule("corebit.reg"),
+                     {{"init", Const::make(c, false)}});
+
+    def->connect("self.IN", "dff0.in");
+    def->connect("self.CLK", "dff0.clk");
+    def->connect("dff0.out", "self.OUT");
+
+    dffTest->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    string path = "./dff_snapshot.bin";
+    uint64_t key = 17;
+
+    EventSimulator configured(dffTest);
+    configured.setValue("self.IN", BitVec(1, 1));
+    configured.setValue("self.CLK", BitVec(1, 0));
+    configured.setValue("self.CLK", BitVec(1, 1));
+
+    REQUIRE(configured.getBitVec("self.OUT") == BitVec(1, 1));
+    REQUIRE(saveSnapshot(configured, path, key));
+
+    EventSimulator restored(dffTest);
+
+    SECTION("Snapshots for other inputs are ignored") {
+      REQUIRE(!loadSnapshot(restored, path, key + 1));
+      REQUIRE(!restored.getBitVec("self.OUT").is_binary());
     }
 
-    SECTION("Bitvector that is not all ones") {
-      state.setValue("self.in", BitVec(n, "11011101111"));
+    SECTION("Matching snapshots restore values and clocks") {
+      REQUIRE(loadSnapshot(restored, path, key));
+      REQUIRE(restored.getBitVec("self.OUT") == BitVec(1, 1));
 
-      REQUIRE(state.getBitVec("self.out") == BitVec(1, 0));
+      // The restored clock is high, so only a new rising edge samples IN
+      restored.setValue("self.IN", BitVec(1, 0));
+      restored.setValue("self.CLK", BitVec(1, 1));
+      REQUIRE(restored.getBitVec("self.OUT") == BitVec(1, 1));
+
+      restored.setValue("self.CLK", BitVec(1, 0));
+      restored.setValue("self.CLK", BitVec(1, 1));
+      REQUIRE(restored.getBitVec("self.OUT") == BitVec(1, 0));
     }
 
+    std::remove(path.c_str());
+
     deleteContext(c);
   }
 
-  TEST_CASE("Simulating a mux loop") {
+  TEST_CASE("Two state mode after reset") {
+    Context* c = newContext();
+    CoreIRLoadLibrary_commonlib(c);
+
+    Namespace* g = c->getGlobal();
+      
+    Module* dff = c->getModule("corebit.reg");
+    Type* dffType = c->Record({
+        {"IN", c->BitIn()},
+          {"CLK", c->Named("coreir.clkIn")},
+            {"OUT", c->Bit()}
+      });
+
+    Module* dffTest = g->newModuleDecl("dffTest", dffType);
+    ModuleDef* def = dffTest->newModuleDef();
+
+    def->addInstance("dff0",
+                     dff,
+                     {{"init", Const::make(c, true)}});
+
+    def->connect("self.IN", "dff0.in");
+    def->connect("self.CLK", "dff0.clk");
+    def->connect("dff0.out", "self.OUT");
+
+    dffTest->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(dffTest);
+
+    TwoStateOptions options;
+    options.requireKnownRegisters = true;
+
+    REQUIRE(state.unknownRegisters() == vector<string>{"dff0"});
+    REQUIRE(!state.enterTwoStateMode(options));
+    REQUIRE(!state.isTwoState());
+
+    state.setValue("self.IN", BitVec(1, 1));
+    state.setValue("self.CLK", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 1));
+
+    REQUIRE(state.enterTwoStateMode(options));
+    REQUIRE(state.isTwoState());
+
+    state.setValue("self.IN", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 1));
 
+    REQUIRE(state.getBitVec("self.OUT") == BitVec(1, 0));
+
+    // Setting an input to its current value schedules nothing
+    state.resetEventStats();
+    state.setValue("self.IN", BitVec(1, 0));
+
+    REQUIRE(state.getEventStats().signalsProcessed == 0);
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Async reset wins over a clock edge in the same batch") {
     Context* c = newContext();
     Namespace* g = c->getGlobal();
 
-    uint width = 2;
+    uint width = 4;
+
+    Type* arstType = c->Record({
+        {"clk", c->Named("coreir.clkIn")},
+          {"rst", c->Named("coreir.arstIn")},
+            {"in", c->Array(width, c->BitIn())},
+              {"out", c->Array(width, c->Bit())}
+      });
+
+    Module* arstTest = g->newModuleDecl("arstTest", arstType);
+    ModuleDef* def = arstTest->newModuleDef();
+
+    def->addInstance("r0",
+                     "coreir.reg_arst",
+                     {{"width", Const::make(c, width)}},
+                     {{"init", Const::make(c, BitVector(width, 5))},
+                         {"clk_posedge", Const::make(c, true)},
+                           {"arst_posedge", Const::make(c, true)}});
+
+    def->connect("self.clk", "r0.clk");
+    def->connect("self.rst", "r0.arst");
+    def->connect("self.in", "r0.in");
+    def->connect("r0.out", "self.out");
+
+    arstTest->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(arstTest);
+
+    state.setValue("self.rst", BitVec(1, 0));
+    state.setValue("self.clk", BitVec(1, 0));
+    state.setValue("self.in", BitVec(width, 9));
+    state.setValue("self.clk", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("self.out") == BitVec(width, 9));
+
+    state.setValue("self.clk", BitVec(1, 0));
+    state.setValues({{"self.clk", BitVec(1, 1)}, {"self.rst", BitVec(1, 1)}});
+
+    REQUIRE(state.getBitVec("self.out") == BitVec(width, 5));
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Re-elaborating after editing the definition") {
+    Context* c = newContext();
+    CoreIRLoadLibrary_commonlib(c);
+
+    Namespace* g = c->getGlobal();
+
+    Type* dffType = c->Record({
+        {"IN", c->BitIn()},
+          {"CLK", c->Named("coreir.clkIn")},
+            {"OUT", c->Bit()}
+      });
+
+    Module* dffTest = g->newModuleDecl("dffTest", dffType);
+    ModuleDef* def = dffTest->newModuleDef();
+
+    def->addInstance("dff0",
+                     c->getModule("corebit.reg"),
+                     {{"init", Const::make(c, false)}});
+
+    def->connect("self.IN", "dff0.in");
+    def->connect("self.CLK", "dff0.clk");
+    def->connect("dff0.out", "self.OUT");
+
+    dffTest->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(dffTest);
+
+    state.setValue("self.IN", BitVec(1, 1));
+    state.setValue("self.CLK", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("self.OUT") == BitVec(1, 1));
+    REQUIRE(!state.reelaborate());
+
+    def->disconnect(def->sel("dff0.out"), def->sel("self.OUT"));
+    def->addInstance("not0", c->getModule("corebit.not"));
+    def->connect("dff0.out", "not0.in");
+    def->connect("not0.out", "self.OUT");
+
+    REQUIRE(state.reelaborate());
+
+    // The register keeps its state and only the new inverter is evaluated
+    REQUIRE(state.getBitVec("dff0.out") == BitVec(1, 1));
+    REQUIRE(state.getBitVec("self.OUT") == BitVec(1, 0));
+
+    state.setValue("self.IN", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("self.OUT") == BitVec(1, 1));
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Aliased inputs still drive registers after re-elaborating") {
+    Context* c = newContext();
+    CoreIRLoadLibrary_commonlib(c);
+
+    Namespace* g = c->getGlobal();
+
+    Type* dffType = c->Record({
+        {"IN", c->BitIn()},
+          {"CLK", c->Named("coreir.clkIn")},
+            {"OUT", c->Bit()},
+              {"NOT_IN", c->Bit()}
+      });
+
+    Module* dffTest = g->newModuleDecl("dffAliasTest", dffType);
+    ModuleDef* def = dffTest->newModuleDef();
+
+    def->addInstance("dff0",
+                     c->getModule("corebit.reg"),
+                     {{"init", Const::make(c, false)}});
+
+    def->connect("self.IN", "dff0.in");
+    def->connect("self.CLK", "dff0.clk");
+    def->connect("dff0.out", "self.OUT");
+
+    dffTest->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(dffTest);
+
+    state.setValue("self.IN", BitVec(1, 1));
+    state.setValue("self.CLK", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("self.OUT") == BitVec(1, 1));
+
+    // dff0 is untouched, so self.IN stays aliased to dff0.in
+    def->addInstance("not0", c->getModule("corebit.not"));
+    def->connect("self.IN", "not0.in");
+    def->connect("not0.out", "self.NOT_IN");
+
+    REQUIRE(state.reelaborate());
+
+    state.setValue("self.IN", BitVec(1, 0));
+    REQUIRE(state.getBitVec("dff0.in") == BitVec(1, 0));
+    REQUIRE(state.getBitVec("self.NOT_IN") == BitVec(1, 1));
+
+    state.setValue("self.CLK", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("self.OUT") == BitVec(1, 0));
+
+    state.setValue("self.IN", BitVec(1, 1));
+    state.setValue("self.CLK", BitVec(1, 0));
+    state.setValue("self.CLK", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("self.OUT") == BitVec(1, 1));
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Submodules added by re-elaborating inherit two state mode") {
+    Context* c = newContext();
+    CoreIRLoadLibrary_commonlib(c);
+
+    Namespace* g = c->getGlobal();
+
+    Type* dffType = c->Record({
+        {"IN", c->BitIn()},
+          {"CLK", c->Named("coreir.clkIn")},
+            {"OUT", c->Bit()},
+              {"GATED", c->Bit()}
+      });
+
+    Module* dffTest = g->newModuleDecl("dffGateTest", dffType);
+    ModuleDef* def = dffTest->newModuleDef();
+
+    def->addInstance("dff0",
+                     c->getModule("corebit.reg"),
+                     {{"init", Const::make(c, false)}});
+
+    def->connect("self.IN", "dff0.in");
+    def->connect("self.CLK", "dff0.clk");
+    def->connect("dff0.out", "self.OUT");
+
+    dffTest->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(dffTest);
+    state.enableCausalityLog(16);
+
+    state.setValue("self.IN", BitVec(1, 1));
+    state.setValue("self.CLK", BitVec(1, 0));
+
+    REQUIRE(state.enterTwoStateMode(TwoStateOptions()));
+
+    // or0.in1 is never driven, so it only has a known value in two
+    // state mode
+    Type* orStageType = c->Record({
+        {"in", c->BitIn()},
+          {"out", c->Bit()}
+      });
+
+    Module* orStage = g->newModuleDecl("orStage", orStageType);
+    ModuleDef* orDef = orStage->newModuleDef();
+
+    orDef->addInstance("or0", c->getModule("corebit.or"));
+    orDef->connect("self.in", "or0.in0");
+    orDef->connect("or0.out", "self.out");
+
+    orStage->setDef(orDef);
+
+    def->addInstance("gate", orStage);
+    def->connect("self.IN", "gate.in");
+    def->connect("gate.out", "self.GATED");
+
+    REQUIRE(state.reelaborate());
+    REQUIRE(state.getBitVec("self.GATED") == BitVec(1, 1));
+
+    state.setValue("self.IN", BitVec(1, 0));
+
+    REQUIRE(state.getBitVec("self.GATED") == BitVec(1, 0));
+    REQUIRE(state.explain("gate$or0.out").size() > 0);
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Freezing a configuration register") {
+    Context* c = newContext();
+    CoreIRLoadLibrary_commonlib(c);
+
+    Namespace* g = c->getGlobal();
+
+    uint width = 4;
+
+    Type* cfgMuxType = c->Record({
+        {"clk", c->Named("coreir.clkIn")},
+          {"cfg", c->BitIn()},
+            {"a", c->Array(width, c->BitIn())},
+              {"b", c->Array(width, c->BitIn())},
+                {"out", c->Array(width, c->Bit())}
+      });
+
+    Module* cfgMux = g->newModuleDecl("cfgMux", cfgMuxType);
+    ModuleDef* def = cfgMux->newModuleDef();
+
+    def->addInstance("cfgReg",
+                     c->getModule("corebit.reg"),
+                     {{"init", Const::make(c, false)}});
+    def->addInstance("mux0", "coreir.mux", {{"width", Const::make(c, width)}});
+
+    def->connect("self.clk", "cfgReg.clk");
+    def->connect("self.cfg", "cfgReg.in");
+    def->connect("cfgReg.out", "mux0.sel");
+    def->connect("self.a", "mux0.in0");
+    def->connect("self.b", "mux0.in1");
+    def->connect("mux0.out", "self.out");
+
+    cfgMux->setDef(def);
+
+    c->runPasses({"rungenerators", "flatten", "flattentypes"});
+
+    EventSimulator state(cfgMux);
+
+    state.setValue("self.cfg", BitVec(1, 1));
+    state.setValue("self.clk", BitVec(1, 0));
+    state.setValue("self.clk", BitVec(1, 1));
+
+    state.freezeConfiguration(vector<string>{"cfgReg"});
+
+    REQUIRE(state.numFrozenNodes() == 1);
+
+    state.setValue("self.a", BitVec(width, 3));
+    state.setValue("self.b", BitVec(width, 7));
+
+    REQUIRE(state.getBitVec("self.out") == BitVec(width, 7));
+
+    state.setValue("self.cfg", BitVec(1, 0));
+    state.setValue("self.clk", BitVec(1, 0));
+    state.setValue("self.clk", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("self.out") == BitVec(width, 7));
+
+    state.unfreezeConfiguration();
+
+    state.setValue("self.clk", BitVec(1, 0));
+    state.setValue("self.clk", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("self.out") == BitVec(width, 3));
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("andr") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+    
+    uint n = 11;
+
+    Generator* andr = c->getGenerator("coreir.andr");
+    Type* andrNType = c->Record({
+        {"in", c->Array(n, c->BitIn())},
+          {"out", c->Bit()}
+      });
+
+    Module* andrN = g->newModuleDecl("andrN", andrNType);
+    ModuleDef* def = andrN->newModuleDef();
+
+    Wireable* self = def->sel("self");
+    Wireable* andr0 = def->addInstance("andr0", andr, {{"width", Const::make(c,n)}});
+    
+    def->connect(self->sel("in"), andr0->sel("in"));
+    def->connect(andr0->sel("out"),self->sel("out"));
+
+    andrN->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(andrN);
+
+    SECTION("Bitvector that is all ones") {
+      state.setValue("self.in", BitVec(n, "11111111111"));
+
+      SECTION("Input is actually set") {
+        REQUIRE(state.getBitVec("self.in") == BitVec(n, "11111111111"));
+      }
+
+      REQUIRE(state.getBitVec("self.out") == BitVec(1, 1));
+    }
+
+    SECTION("Bitvector that is not all ones") {
+      state.setValue("self.in", BitVec(n, "11011101111"));
+
+      REQUIRE(state.getBitVec("self.out") == BitVec(1, 0));
+    }
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Pipelines split across submodules advance one stage per edge") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    Type* stageType = c->Record({
+        {"in", c->BitIn()},
+          {"clk", c->Named("coreir.clkIn")},
+            {"out", c->Bit()}
+      });
+
+    Module* stage = g->newModuleDecl("pipeStage", stageType);
+    ModuleDef* stageDef = stage->newModuleDef();
+
+    stageDef->addInstance("dff0",
+                          c->getModule("corebit.reg"),
+                          {{"init", Const::make(c, false)}});
+
+    stageDef->connect("self.in", "dff0.in");
+    stageDef->connect("self.clk", "dff0.clk");
+    stageDef->connect("dff0.out", "self.out");
+
+    stage->setDef(stageDef);
+
+    Module* top = g->newModuleDecl("twoStagePipe", stageType);
+    ModuleDef* def = top->newModuleDef();
+
+    // Declared in reverse order so that ranking, not naming, decides which
+    // stage is evaluated first
+    def->addInstance("s1", stage);
+    def->addInstance("s0", stage);
+
+    def->connect("self.in", "s0.in");
+    def->connect("s0.out", "s1.in");
+    def->connect("s1.out", "self.out");
+    def->connect("self.clk", "s0.clk");
+    def->connect("self.clk", "s1.clk");
+
+    top->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes"});
+
+    EventSimulator state(top);
+
+    state.setValue("self.clk", BitVec(1, 0));
+    state.setValue("self.in", BitVec(1, 1));
+
+    state.setValue("self.clk", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("s0$dff0.out") == BitVec(1, 1));
+    REQUIRE(state.getBitVec("self.out") == BitVec(1, 0));
+
+    state.setValue("self.clk", BitVec(1, 0));
+    state.setValue("self.in", BitVec(1, 0));
+    state.setValue("self.clk", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("s0$dff0.out") == BitVec(1, 0));
+    REQUIRE(state.getBitVec("self.out") == BitVec(1, 1));
+
+    state.setValue("self.clk", BitVec(1, 0));
+    state.setValue("self.clk", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("self.out") == BitVec(1, 0));
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Only outputs that change are scheduled") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    Type* pairType = c->Record({
+        {"a", c->BitIn()},
+          {"b", c->BitIn()},
+            {"x", c->Bit()},
+              {"y", c->Bit()}
+      });
+
+    Module* pair = g->newModuleDecl("notPair", pairType);
+    ModuleDef* pairDef = pair->newModuleDef();
+
+    pairDef->addInstance("not0", c->getModule("corebit.not"));
+    pairDef->addInstance("not1", c->getModule("corebit.not"));
+
+    pairDef->connect("self.a", "not0.in");
+    pairDef->connect("not0.out", "self.x");
+    pairDef->connect("self.b", "not1.in");
+    pairDef->connect("not1.out", "self.y");
+
+    pair->setDef(pairDef);
+
+    Type* topType = c->Record({
+        {"A", c->BitIn()},
+          {"B", c->BitIn()},
+            {"X", c->Bit()},
+              {"Y", c->Bit()}
+      });
+
+    Module* top = g->newModuleDecl("notPairTop", topType);
+    ModuleDef* def = top->newModuleDef();
+
+    def->addInstance("pair0", pair);
+
+    def->connect("self.A", "pair0.a");
+    def->connect("self.B", "pair0.b");
+    def->connect("pair0.x", "self.X");
+    def->connect("pair0.y", "self.Y");
+
+    top->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes"});
+
+    EventSimulator state(top);
+
+    state.setValue("self.A", BitVec(1, 0));
+    state.setValue("self.B", BitVec(1, 0));
+
+    REQUIRE(state.getBitVec("self.X") == BitVec(1, 1));
+    REQUIRE(state.getBitVec("self.Y") == BitVec(1, 1));
+
+    state.resetEventStats();
+    state.setValue("self.A", BitVec(1, 1));
+
+    REQUIRE(state.getBitVec("self.X") == BitVec(1, 0));
+    REQUIRE(state.getBitVec("self.Y") == BitVec(1, 1));
+
+    // not0.out inside the submodule and pair0.x, but not pair0.y
+    EventStats stats = state.getEventStats();
+    REQUIRE(stats.nodesEvaluated == 2);
+    REQUIRE(stats.outputsScheduled == 2);
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("andr only reports a change when its output moves") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    uint n = 4;
+
+    Type* andrNType = c->Record({
+        {"in", c->Array(n, c->BitIn())},
+          {"out", c->Bit()}
+      });
+
+    Module* andrN = g->newModuleDecl("andrN", andrNType);
+    ModuleDef* def = andrN->newModuleDef();
+
+    def->addInstance("andr0",
+                     c->getGenerator("coreir.andr"),
+                     {{"width", Const::make(c, n)}});
+
+    def->connect("self.in", "andr0.in");
+    def->connect("andr0.out", "self.out");
+
+    andrN->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(andrN);
+
+    state.setValue("self.in", BitVec(n, "1110"));
+    REQUIRE(state.getBitVec("self.out") == BitVec(1, 0));
+
+    state.resetEventStats();
+    state.setValue("self.in", BitVec(n, "1100"));
+
+    REQUIRE(state.getBitVec("self.out") == BitVec(1, 0));
+    REQUIRE(state.getEventStats().nodesEvaluated == 1);
+    REQUIRE(state.getEventStats().outputsScheduled == 0);
+
+    state.setValue("self.in", BitVec(n, "1111"));
+
+    REQUIRE(state.getBitVec("self.out") == BitVec(1, 1));
+    REQUIRE(state.getEventStats().outputsScheduled == 1);
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Explaining a value from the causality log") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    Type* chainType = c->Record({
+        {"a", c->BitIn()},
+          {"out", c->Bit()}
+      });
+
+    Module* chain = g->newModuleDecl("notChain", chainType);
+    ModuleDef* def = chain->newModuleDef();
+
+    def->addInstance("not0", c->getModule("corebit.not"));
+    def->addInstance("not1", c->getModule("corebit.not"));
+
+    def->connect("self.a", "not0.in");
+    def->connect("not0.out", "not1.in");
+    def->connect("not1.out", "self.out");
+
+    chain->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(chain);
+    state.enableCausalityLog(16);
+
+    state.setValue("self.a", BitVec(1, 1));
+    state.setValue("self.a", BitVec(1, 0));
+
+    vector<CausalityStep> steps = state.explain("self.out");
+
+    REQUIRE(steps.size() == 3);
+
+    REQUIRE(steps[0].net == "not1.out");
+    REQUIRE(steps[0].cause == "not1");
+    REQUIRE(steps[0].value == 0);
+
+    REQUIRE(steps[1].net == "not0.out");
+    REQUIRE(steps[1].cause == "not0");
+    REQUIRE(steps[1].value == 1);
+
+    // The newest change to the input, not the first one
+    REQUIRE(steps[2].net == "self.a");
+    REQUIRE(steps[2].cause == "");
+    REQUIRE(steps[2].value == 0);
+    REQUIRE(steps[2].time == steps[0].time);
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Querying the transitive drivers and loads of a node") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    Type* toggleType = c->Record({
+        {"en", c->BitIn()},
+          {"clk", c->Named("coreir.clkIn")},
+            {"b", c->BitIn()},
+              {"out", c->Bit()},
+                {"c", c->Bit()}
+      });
+
+    Module* toggle = g->newModuleDecl("toggle", toggleType);
+    ModuleDef* def = toggle->newModuleDef();
+
+    def->addInstance("and0", c->getModule("corebit.and"));
+    def->addInstance("not0", c->getModule("corebit.not"));
+    def->addInstance("not1", c->getModule("corebit.not"));
+    def->addInstance("dff0",
+                     c->getModule("corebit.reg"),
+                     {{"init", Const::make(c, false)}});
+
+    def->connect("self.en", "and0.in0");
+    def->connect("dff0.out", "and0.in1");
+    def->connect("and0.out", "not0.in");
+    def->connect("not0.out", "dff0.in");
+    def->connect("self.clk", "dff0.clk");
+    def->connect("dff0.out", "self.out");
+
+    def->connect("self.b", "not1.in");
+    def->connect("not1.out", "self.c");
+
+    toggle->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(toggle);
+
+    // The register closes a cycle, so not0 is among its own drivers
+    vector<string> loop{"and0", "dff0", "not0", "self"};
+    REQUIRE(state.transitiveDrivers("not0") == loop);
+    REQUIRE(state.transitiveDrivers("self.out") == loop);
+    REQUIRE(state.transitiveLoads("and0") == loop);
+
+    vector<string> side{"not1", "self"};
+    REQUIRE(state.transitiveDrivers("self.c") == side);
+    REQUIRE(state.transitiveLoads("self.b") == side);
+    REQUIRE(state.transitiveDrivers("not1") == vector<string>{"self"});
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Observing only the cone of influence of chosen outputs") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    Type* toggleType = c->Record({
+        {"en", c->BitIn()},
+          {"clk", c->Named("coreir.clkIn")},
+            {"b", c->BitIn()},
+              {"out", c->Bit()},
+                {"c", c->Bit()}
+      });
+
+    Module* toggle = g->newModuleDecl("toggle", toggleType);
+    ModuleDef* def = toggle->newModuleDef();
+
+    def->addInstance("and0", c->getModule("corebit.and"));
+    def->addInstance("not0", c->getModule("corebit.not"));
+    def->addInstance("not1", c->getModule("corebit.not"));
+    def->addInstance("dff0",
+                     c->getModule("corebit.reg"),
+                     {{"init", Const::make(c, false)}});
+
+    def->connect("self.en", "and0.in0");
+    def->connect("dff0.out", "and0.in1");
+    def->connect("and0.out", "not0.in");
+    def->connect("not0.out", "dff0.in");
+    def->connect("self.clk", "dff0.clk");
+    def->connect("dff0.out", "self.out");
+
+    def->connect("self.b", "not1.in");
+    def->connect("not1.out", "self.c");
+
+    toggle->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(toggle);
+    state.setValue("self.en", BitVec(1, 1));
+    state.setValue("self.clk", BitVec(1, 0));
+
+    REQUIRE(state.observe({"self.c"}));
+
+    REQUIRE(state.numUnobservedNodes() == 3);
+
+    // Unknown names are rejected and leave the cone as it was
+    REQUIRE(!state.observe({"self.out", "not9.out"}));
+    REQUIRE(state.numUnobservedNodes() == 3);
+
+    state.setValue("self.b", BitVec(1, 0));
+    REQUIRE(state.getBitVec("self.c") == BitVec(1, 1));
+
+    // The toggle is outside the cone, so the clock edge is ignored
+    state.setValue("self.clk", BitVec(1, 1));
+    REQUIRE(state.getBitVec("self.out") == BitVec(1, 0));
+
+    state.setValue("self.clk", BitVec(1, 0));
+    REQUIRE(state.observe({"self.out"}));
+
+    REQUIRE(state.numUnobservedNodes() == 0);
+
+    state.setValue("self.clk", BitVec(1, 1));
+    REQUIRE(state.getBitVec("self.out") == BitVec(1, 1));
+
+    state.setValue("self.b", BitVec(1, 1));
+    REQUIRE(state.getBitVec("self.c") == BitVec(1, 0));
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Simulating a mux loop") {
+
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    uint width = 2;
+
+    Type* twoMuxType =
+      c->Record({
+          {"in", c->BitIn()->Arr(width)},
+            {"sel", c->BitIn()},
+              {"out", c->Bit()->Arr(width)}
+        });
+
+    Module* twoMux = c->getGlobal()->newModuleDecl("twoMux", twoMuxType);
+    ModuleDef* def = twoMux->newModuleDef();
+
+    def->addInstance("mux0",
+                     "coreir.mux",
+                     {{"width", Const::make(c, width)}});
+
+    def->connect("self.sel", "mux0.sel");
+    def->connect("self.in", "mux0.in0");
+    def->connect("mux0.out", "mux0.in1");
+    def->connect("mux0.out", "self.out");
+
+    twoMux->setDef(def);
+
+    c->runPasses({"rungenerators", "flatten", "flattentypes", "wireclocks-coreir"});
+
+    cout << "Creating twoMux simulation" << endl;
+
+    EventSimulator state(twoMux);
+
+    state.setValue("self.sel", BitVector(1, 0));    
+    state.setValue("self.in", BitVector(width, "11"));
+
+    REQUIRE(state.getBitVec("self.out") == BitVector(width, "11"));
+      
+    deleteContext(c);
+    
+  }
+
+  TEST_CASE("Oscillating loops are reported instead of hanging") {
+    Context* c = newContext();
+
+    uint width = 1;
 
-    Type* twoMuxType =
+    Type* ringType =
       c->Record({
-          {"in", c->BitIn()->Arr(width)},
+          {"init", c->BitIn()->Arr(width)},
             {"sel", c->BitIn()},
               {"out", c->Bit()->Arr(width)}
         });
 
-    Module* twoMux = c->getGlobal()->newModuleDecl("twoMux", twoMuxType);
-    ModuleDef* def = twoMux->newModuleDef();
+    Module* ring = c->getGlobal()->newModuleDecl("ring", ringType);
+    ModuleDef* def = ring->newModuleDef();
 
     def->addInstance("mux0",
                      "coreir.mux",
                      {{"width", Const::make(c, width)}});
+    def->addInstance("not0",
+                     "coreir.not",
+                     {{"width", Const::make(c, width)}});
 
     def->connect("self.sel", "mux0.sel");
-    def->connect("self.in", "mux0.in0");
-    def->connect("mux0.out", "mux0.in1");
-    def->connect("mux0.out", "self.out");
+    def->connect("self.init", "mux0.in0");
+    def->connect("not0.out", "mux0.in1");
+    def->connect("mux0.out", "not0.in");
+    def->connect("not0.out", "self.out");
 
-    twoMux->setDef(def);
+    ring->setDef(def);
 
-    c->runPasses({"rungenerators", "flatten", "flattentypes", "wireclocks-coreir"});
+    c->runPasses({"rungenerators", "flatten", "flattentypes"});
 
-    cout << "Creating twoMux simulation" << endl;
+    ElaborationOptions options;
+    options.maxLoopIterations = 8;
+    EventSimulator state(ring, options);
 
-    EventSimulator state(twoMux);
+    state.setValue("self.init", BitVector(width, "0"));
+    state.setValue("self.sel", BitVector(1, 0));
 
-    state.setValue("self.sel", BitVector(1, 0));    
-    state.setValue("self.in", BitVector(width, "11"));
+    REQUIRE(state.getBitVec("self.out") == BitVector(width, "1"));
+    REQUIRE(state.oscillatingLoops().size() == 0);
+
+    state.setValue("self.sel", BitVector(1, 1));
+
+    vector<string> loops = state.oscillatingLoops();
+    REQUIRE(loops.size() == 1);
+    REQUIRE(loops[0] == "mux0, not0");
 
-    REQUIRE(state.getBitVec("self.out") == BitVector(width, "11"));
-      
     deleteContext(c);
-    
   }
 
   TEST_CASE("Commonlib mux") {
@@ -406,6 +1468,449 @@ namespace EventSim {
     
   }
 
+  TEST_CASE("Change masks of partial bus updates") {
+    REQUIRE(changedRange(2, 5) == 0x1c);
+    REQUIRE(changedRange(60, 100) == (ALL_BITS_CHANGED << 60));
+    REQUIRE(changedBit(70) == changedBit(63));
+
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    uint width = 16;
+
+    Type* sliceType =
+      c->Record({
+          {"in", c->Array(width, c->BitIn())},
+            {"low", c->Array(4, c->Bit())},
+              {"high", c->Array(4, c->Bit())}
+        });
+
+    Module* sliceTest = g->newModuleDecl("sliceTest", sliceType);
+    ModuleDef* def = sliceTest->newModuleDef();
+
+    def->addInstance("lowSlice",
+                     "coreir.slice",
+                     {{"width", Const::make(c, width)},
+                         {"lo", Const::make(c, 0)},
+                           {"hi", Const::make(c, 4)}});
+    def->addInstance("highSlice",
+                     "coreir.slice",
+                     {{"width", Const::make(c, width)},
+                         {"lo", Const::make(c, 8)},
+                           {"hi", Const::make(c, 12)}});
+
+    def->connect("self.in", "lowSlice.in");
+    def->connect("self.in", "highSlice.in");
+    def->connect("lowSlice.out", "self.low");
+    def->connect("highSlice.out", "self.high");
+
+    sliceTest->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(sliceTest);
+
+    state.setValue("self.in", BitVec(width, 0x0a05));
+
+    REQUIRE(state.getBitVec("self.low") == BitVec(4, 0x5));
+    REQUIRE(state.getBitVec("self.high") == BitVec(4, 0xa));
+
+    state.setValue("self.in", BitVec(width, 0x0a03));
+
+    REQUIRE(state.getBitVec("self.low") == BitVec(4, 0x3));
+    REQUIRE(state.getBitVec("self.high") == BitVec(4, 0xa));
+
+    state.setValue("self.in", BitVec(width, 0xfa03));
+
+    REQUIRE(state.getBitVec("self.low") == BitVec(4, 0x3));
+    REQUIRE(state.getBitVec("self.high") == BitVec(4, 0xa));
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Known and unknown operands of binary operators") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    uint width = 8;
+
+    Type* arithType =
+      c->Record({
+          {"in0", c->Array(width, c->BitIn())},
+            {"in1", c->Array(width, c->BitIn())},
+              {"sum", c->Array(width, c->Bit())},
+                {"shifted", c->Array(width, c->Bit())}
+        });
+
+    Module* arith = g->newModuleDecl("arith", arithType);
+    ModuleDef* def = arith->newModuleDef();
+
+    def->addInstance("add0", "coreir.add", {{"width", Const::make(c, width)}});
+    def->addInstance("ashr0", "coreir.ashr", {{"width", Const::make(c, width)}});
+
+    def->connect("self.in0", "add0.in0");
+    def->connect("self.in1", "add0.in1");
+    def->connect("add0.out", "self.sum");
+
+    def->connect("self.in0", "ashr0.in0");
+    def->connect("self.in1", "ashr0.in1");
+    def->connect("ashr0.out", "self.shifted");
+
+    arith->setDef(def);
+
+    c->runPasses({"rungenerators", "flatten", "flattentypes"});
+
+    EventSimulator state(arith);
+
+    state.setValue("self.in0", BitVec(width, 128));
+
+    SECTION("Unknown operand gives an unknown result") {
+      REQUIRE(!state.getBitVec("self.sum").get(0).is_binary());
+    }
+
+    SECTION("Known operands wrap and shift arithmetically") {
+      state.setValue("self.in1", BitVec(width, 130));
+
+      REQUIRE(state.getBitVec("self.sum") == BitVec(width, 2));
+
+      state.setValue("self.in1", BitVec(width, 2));
+
+      REQUIRE(state.getBitVec("self.shifted") == BitVec(width, 224));
+    }
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Replaying a binary stimulus file") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    uint width = 16;
+
+    Type* adderType =
+      c->Record({
+          {"in0", c->Array(width, c->BitIn())},
+            {"in1", c->Array(width, c->BitIn())},
+              {"sum", c->Array(width, c->Bit())}
+        });
+
+    Module* adder = g->newModuleDecl("adder", adderType);
+    ModuleDef* def = adder->newModuleDef();
+
+    def->addInstance("add0", "coreir.add", {{"width", Const::make(c, width)}});
+
+    def->connect("self.in0", "add0.in0");
+    def->connect("self.in1", "add0.in1");
+    def->connect("add0.out", "self.sum");
+
+    adder->setDef(def);
+
+    c->runPasses({"rungenerators", "flatten", "flattentypes"});
+
+    string path = "./adder_stimulus.bin";
+
+    {
+      StimulusWriter writer(path, {{"self.in0", (int) width},
+            {"self.in1", (int) width}});
+      REQUIRE(writer.isOpen());
+
+      writer.writeCycle({1, 2});
+      writer.writeCycle({100, 23});
+      writer.writeCycle({65535, 2});
+    }
+
+    REQUIRE(isBinaryStimulus(path));
+
+    EventSimulator state(adder);
+    StimulusPlayer player(state, path);
+
+    REQUIRE(player.isOpen());
+    REQUIRE(player.getNumCycles() == 3);
+    REQUIRE(player.getPorts()[1].name == "self.in1");
+
+    player.applyCycle(0);
+    REQUIRE(state.getBitVec("self.sum") == BitVec(width, 3));
+
+    player.applyCycle(1);
+    REQUIRE(state.getBitVec("self.sum") == BitVec(width, 123));
+
+    player.applyCycle(2);
+    REQUIRE(state.getBitVec("self.sum") == BitVec(width, 1));
+
+    SECTION("Files that do not match the design fail to open") {
+      string badPath = "./adder_bad_stimulus.bin";
+
+      {
+        StimulusWriter writer(badPath, {{"self.in0", 8}});
+        writer.writeCycle({1});
+      }
+      REQUIRE(!StimulusPlayer(state, badPath).isOpen());
+
+      {
+        StimulusWriter writer(badPath, {{"self.in2", (int) width}});
+        writer.writeCycle({1});
+      }
+      REQUIRE(!StimulusPlayer(state, badPath).isOpen());
+
+      // A cycle count whose size in bytes wraps around to 0
+      {
+        StimulusWriter writer(badPath, {{"self.in0", (int) width},
+              {"self.in1", (int) width}});
+      }
+      {
+        fstream patch(badPath, ios::in | ios::out | ios::binary);
+        uint64_t numCycles = ((uint64_t) 1) << 60;
+        patch.seekp(8);
+        patch.write(reinterpret_cast<const char*>(&numCycles), sizeof(numCycles));
+      }
+      REQUIRE(!StimulusPlayer(state, badPath).isOpen());
+
+      std::remove(badPath.c_str());
+    }
+
+    std::remove(path.c_str());
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Recording outputs in columnar blocks") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    uint width = 16;
+
+    Type* adderType =
+      c->Record({
+          {"in0", c->Array(width, c->BitIn())},
+            {"in1", c->Array(width, c->BitIn())},
+              {"sum", c->Array(width, c->Bit())}
+        });
+
+    Module* adder = g->newModuleDecl("adder", adderType);
+    ModuleDef* def = adder->newModuleDef();
+
+    def->addInstance("add0", "coreir.add", {{"width", Const::make(c, width)}});
+
+    def->connect("self.in0", "add0.in0");
+    def->connect("self.in1", "add0.in1");
+    def->connect("add0.out", "self.sum");
+
+    adder->setDef(def);
+
+    c->runPasses({"rungenerators", "flatten", "flattentypes"});
+
+    string path = "./adder_outputs.bin";
+
+    EventSimulator state(adder);
+
+    {
+      OutputRecorder recorder(state, {"self.sum", "self.in0"}, path, 2);
+      REQUIRE(recorder.isOpen());
+
+      state.setValue("self.in0", BitVec(width, 1));
+      recorder.sample();
+
+      state.setValue("self.in1", BitVec(width, 2));
+      recorder.sample();
+
+      state.setValue("self.in1", BitVec(width, 5));
+      recorder.sample();
+
+      REQUIRE(recorder.getNumCycles() == 3);
+    }
+
+    ifstream in(path, ios::binary);
+    vector<char> bytes((istreambuf_iterator<char>(in)),
+                       istreambuf_iterator<char>());
+
+    auto wordAt = [&bytes](const size_t pos) {
+      uint64_t word;
+      memcpy(&word, &bytes[pos], sizeof(word));
+      return word;
+    };
+
+    // Header, then "self.sum" and "self.in0" with their lengths and
+    // widths, padded to 8 bytes
+    REQUIRE(wordAt(8) == 3);
+    size_t pos = 24 + 2 * (4 + 8 + 4);
+    pos += (8 - (pos % 8)) % 8;
+
+    // First block of two cycles: sum values, sum unknowns, in0 values,
+    // in0 unknowns. in1 is still x in the first cycle.
+    REQUIRE(wordAt(pos) == 2);
+    REQUIRE(wordAt(pos + 8) == 0);
+    REQUIRE(wordAt(pos + 16) == 3);
+    REQUIRE(wordAt(pos + 24) != 0);
+    REQUIRE(wordAt(pos + 32) == 0);
+    REQUIRE(wordAt(pos + 40) == 1);
+    REQUIRE(wordAt(pos + 48) == 1);
+
+    // Second block holds the last cycle
+    pos += 8 + 8 * 2 * 2 * 2;
+    REQUIRE(wordAt(pos) == 1);
+    REQUIRE(wordAt(pos + 8) == 6);
+
+    in.close();
+    std::remove(path.c_str());
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Checking outputs against a reference trace") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    uint width = 16;
+
+    Type* adderType =
+      c->Record({
+          {"in0", c->Array(width, c->BitIn())},
+            {"in1", c->Array(width, c->BitIn())},
+              {"sum", c->Array(width, c->Bit())}
+        });
+
+    Module* adder = g->newModuleDecl("adder", adderType);
+    ModuleDef* def = adder->newModuleDef();
+
+    def->addInstance("add0", "coreir.add", {{"width", Const::make(c, width)}});
+
+    def->connect("self.in0", "add0.in0");
+    def->connect("self.in1", "add0.in1");
+    def->connect("add0.out", "self.sum");
+
+    adder->setDef(def);
+
+    c->runPasses({"rungenerators", "flatten", "flattentypes"});
+
+    string path = "./adder_reference.bin";
+
+    vector<pair<int, int> > inputs{{1, 2}, {100, 23}, {5, 5}};
+
+    {
+      EventSimulator reference(adder);
+      OutputRecorder recorder(reference, {"self.sum"}, path, 2);
+      for (auto& in : inputs) {
+        reference.setValues({{"self.in0", BitVec(width, in.first)},
+              {"self.in1", BitVec(width, in.second)}});
+        recorder.sample();
+      }
+    }
+
+    EventSimulator state(adder);
+    TraceChecker checker(state, path);
+
+    REQUIRE(checker.isOpen());
+    REQUIRE(checker.getNumCycles() == 3);
+
+    inputs[2].second = 6;
+
+    int numMatched = 0;
+    for (auto& in : inputs) {
+      state.setValues({{"self.in0", BitVec(width, in.first)},
+            {"self.in1", BitVec(width, in.second)}});
+      if (!checker.check()) {
+        break;
+      }
+      numMatched++;
+    }
+
+    REQUIRE(numMatched == 2);
+    REQUIRE(checker.getCycle() == 2);
+    REQUIRE(checker.getMismatches().size() == 1);
+    REQUIRE(checker.getMismatches()[0].name == "self.sum");
+    REQUIRE(checker.getMismatches()[0].expected == 10);
+    REQUIRE(checker.getMismatches()[0].actual == 11);
+
+    // Signals the design does not have are reported instead of asserting
+    {
+      string missingPath = "./adder_missing.bin";
+      OutputRecorder recorder(state, {"self.in0", "self.total"}, missingPath);
+      REQUIRE(!recorder.isOpen());
+      std::remove(missingPath.c_str());
+    }
+
+    Type* renamedType =
+      c->Record({
+          {"in0", c->Array(width, c->BitIn())},
+            {"in1", c->Array(width, c->BitIn())},
+              {"total", c->Array(width, c->Bit())}
+        });
+
+    Module* renamed = g->newModuleDecl("renamed_adder", renamedType);
+    ModuleDef* renamedDef = renamed->newModuleDef();
+
+    renamedDef->addInstance("add0", "coreir.add", {{"width", Const::make(c, width)}});
+
+    renamedDef->connect("self.in0", "add0.in0");
+    renamedDef->connect("self.in1", "add0.in1");
+    renamedDef->connect("add0.out", "self.total");
+
+    renamed->setDef(renamedDef);
+
+    EventSimulator renamedState(renamed);
+    TraceChecker renamedChecker(renamedState, path);
+
+    REQUIRE(!renamedChecker.isOpen());
+
+    std::remove(path.c_str());
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Binary and unary operators evaluate without allocating") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    uint width = 16;
+
+    Type* addNotType =
+      c->Record({
+          {"in0", c->Array(width, c->BitIn())},
+            {"in1", c->Array(width, c->BitIn())},
+              {"out", c->Array(width, c->Bit())}
+        });
+
+    Module* addNot = g->newModuleDecl("addNot", addNotType);
+    ModuleDef* def = addNot->newModuleDef();
+
+    def->addInstance("add0", "coreir.add", {{"width", Const::make(c, width)}});
+    def->addInstance("not0", "coreir.not", {{"width", Const::make(c, width)}});
+
+    def->connect("self.in0", "add0.in0");
+    def->connect("self.in1", "add0.in1");
+    def->connect("add0.out", "not0.in");
+    def->connect("not0.out", "self.out");
+
+    addNot->setDef(def);
+
+    c->runPasses({"rungenerators","flattentypes","flatten"});
+
+    EventSimulator state(addNot);
+
+    Instance* add0 = def->getInstances().at("add0");
+    Instance* not0 = def->getInstances().at("not0");
+
+    state.setValue("self.in0", BitVec(width, 3));
+    state.setValue("self.in1", BitVec(width, 4));
+
+    REQUIRE(state.getBitVec("self.out") == ~BitVec(width, 7));
+
+    BitVec in0(width, 0);
+    state.setValueNoUpdate(def->sel("self")->sel("in0"), in0);
+
+    long before = numAllocations;
+    for (int i = 0; i < 100; i++) {
+      state.updateInstance(add0);
+      state.updateInstance(not0);
+    }
+    long allocated = numAllocations - before;
+
+    REQUIRE(allocated == 0);
+    REQUIRE(state.getBitVec("self.out") == ~BitVec(width, 4));
+
+    deleteContext(c);
+  }
+
   TEST_CASE("CGRA connect box") {
     Context* c = newContext();
     Namespace* g = c->getGlobal();
@@ -612,6 +2117,86 @@ namespace EventSim {
     deleteContext(c);
   }
 
+  TEST_CASE("Copying the PE tile interface", "[.][benchmark]") {
+    Context* c = newContext();
+
+    CoreIRLoadLibrary_rtlil(c);
+
+    Module* top;
+    if (!loadFromFile(c,"./test/pe_tile_new_unq1.json", &top)) {
+      cout << "Could not Load from json!!" << endl;
+      c->die();
+    }
+
+    top = c->getModule("global.pe_tile_new_unq1");
+
+    c->runPasses({"rungenerators", "packconnections"});
+
+    EventSimulator sim(top);
+    sim.setValue("self.tile_id", BitVector("16'h15"));
+
+    WireValue* self = sim.getSelfValue();
+    WireValue* copy = sim.instantiateWireValue(self);
+
+    int numCopies = 10000;
+
+    long before = numAllocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numCopies; i++) {
+      copyWireValueOver(copy, self);
+    }
+    auto end = std::chrono::steady_clock::now();
+    long allocated = numAllocations - before;
+
+    double nsPerCopy =
+      std::chrono::duration<double, std::nano>(end - start).count() / numCopies;
+    cout << "Copying " << static_cast<RecordValue*>(self)->getFields().size()
+         << " interface fields takes " << nsPerCopy << " ns" << endl;
+
+    REQUIRE(allocated == 0);
+    REQUIRE(extractBitVector(*static_cast<RecordValue*>(copy)->getFieldValue("tile_id")) ==
+            BitVector("16'h15"));
+
+    deleteContext(c);
+  }
+
+  TEST_CASE("Parallel elaboration of the PE tile") {
+    Context* c = newContext();
+    Namespace* g = c->getGlobal();
+
+    CoreIRLoadLibrary_rtlil(c);
+
+    Module* top;
+    if (!loadFromFile(c,"./test/pe_tile_new_unq1.json", &top)) {
+      cout << "Could not Load from json!!" << endl;
+      c->die();
+    }
+
+    top = c->getModule("global.pe_tile_new_unq1");
+
+    c->runPasses({"rungenerators", "packconnections"});
+
+    ElaborationOptions parallel;
+    parallel.numThreads = 4;
+
+    EventSimulator serialSim(top);
+    EventSimulator parallelSim(top, parallel);
+
+    for (auto sim : {&serialSim, &parallelSim}) {
+      sim->setValue("self.tile_id", BitVector("16'h15"));
+      sim->setValue("self.reset", BitVector("1'h0"));
+      sim->setValue("self.reset", BitVector("1'h1"));
+      sim->setValue("self.reset", BitVector("1'h0"));
+    }
+
+    REQUIRE(same_representation(serialSim.getBitVec("test_pe$self.res"),
+                                parallelSim.getBitVec("test_pe$self.res")));
+    REQUIRE(same_representation(serialSim.getBitVec("self.out_BUS16_S0_T0"),
+                                parallelSim.getBitVec("self.out_BUS16_S0_T0")));
+
+    deleteContext(c);
+  }
+
   // TEST_CASE("Whole 16 x 16 CGRA") {
   //   Context* c = newContext();
   //   Namespace* g = c->getGlobal();
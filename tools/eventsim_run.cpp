@@ -0,0 +1,458 @@
+// Runs a simulation from the command line:
+//
+//   eventsim-run --json design.json --top global.pe_tile_new_unq1
+//                --bitstream config.bsa --stimulus inputs.txt --cycles 100
+//                --outputs self.out_BUS16_S0_T0,self.out_BUS16_S1_T0
+//                --out results.csv
+//
+// Text stimulus files hold one "<cycle> <signal> <value>" assignment per
+// line, where value is a CoreIR bit vector literal such as 16'h5. Lines
+// starting with # are ignored. Binary stimulus files written by
+// StimulusWriter are detected by their magic number and replayed with a
+// StimulusPlayer. Either way inputs are applied before the clock edges of
+// their cycle, and outputs are recorded after them.
+//
+// With --expect, outputs are compared each cycle to a reference trace in
+// the format written by --format binary, and the run stops at the first
+// cycle that differs.
+//
+// With --observe, only the logic feeding the listed signals is evaluated
+// once the configuration is loaded. Recorded or checked outputs outside
+// that cone are not kept up to date.
+
+#include "bitstream.h"
+#include "recorder.h"
+#include "simulator.h"
+#include "stimulus.h"
+#include "coreir/libs/rtlil.h"
+#include "coreir/libs/commonlib.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace CoreIR;
+using namespace EventSim;
+using namespace std;
+
+struct RunOptions {
+  string json;
+  string top;
+  vector<string> passes;
+  string bitstream;
+  string stimulus;
+  int cycles;
+  vector<string> outputs;
+  vector<string> observed;
+  string outFile;
+  string format;
+  string expect;
+
+  string clock;
+  string reset;
+  string configAddr;
+  string configData;
+
+  RunOptions() :
+    passes({"rungenerators", "packconnections"}),
+    cycles(0),
+    format("csv"),
+    clock("self.clk_in"),
+    configAddr("self.config_addr"),
+    configData("self.config_data") {}
+};
+
+struct Assignment {
+  int cycle;
+  string signal;
+  BitVector value;
+};
+
+static vector<string> splitList(const string& list) {
+  vector<string> items;
+  stringstream ss(list);
+  string item;
+  while (getline(ss, item, ',')) {
+    if (item.size() > 0) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+static void printUsage() {
+  cout << "Usage: eventsim-run --json <file> --top <module> [options]" << endl;
+  cout << "  --passes <p0,p1,...>      passes to run, default rungenerators,packconnections" << endl;
+  cout << "  --bitstream <file.bsa>    configuration to clock in before running" << endl;
+  cout << "  --stimulus <file>         input assignments per cycle" << endl;
+  cout << "  --cycles <n>              number of clock cycles to run" << endl;
+  cout << "  --outputs <s0,s1,...>     signals to record after each cycle" << endl;
+  cout << "  --out <file>              where recorded outputs are written" << endl;
+  cout << "  --observe <s0,s1,...>     only evaluate the fan-in of these signals" << endl;
+  cout << "  --format csv|binary       format of the output file, default csv" << endl;
+  cout << "  --expect <trace>          reference trace to compare against each cycle" << endl;
+  cout << "  --clock <signal>          default self.clk_in" << endl;
+  cout << "  --reset <signal>          pulsed high before configuration" << endl;
+  cout << "  --config-addr <signal>    default self.config_addr" << endl;
+  cout << "  --config-data <signal>    default self.config_data" << endl;
+}
+
+static bool parseOptions(int argc, char** argv, RunOptions& options) {
+  for (int i = 1; i < argc; i++) {
+    string flag = argv[i];
+    if (i + 1 >= argc) {
+      cerr << "ERROR: Missing value for " << flag << endl;
+      return false;
+    }
+    string value = argv[++i];
+
+    if (flag == "--json") {
+      options.json = value;
+    } else if (flag == "--top") {
+      options.top = value;
+    } else if (flag == "--passes") {
+      options.passes = splitList(value);
+    } else if (flag == "--bitstream") {
+      options.bitstream = value;
+    } else if (flag == "--stimulus") {
+      options.stimulus = value;
+    } else if (flag == "--cycles") {
+      options.cycles = stoi(value);
+    } else if (flag == "--outputs") {
+      options.outputs = splitList(value);
+    } else if (flag == "--observe") {
+      options.observed = splitList(value);
+    } else if (flag == "--out") {
+      options.outFile = value;
+    } else if (flag == "--format") {
+      options.format = value;
+    } else if (flag == "--expect") {
+      options.expect = value;
+    } else if (flag == "--clock") {
+      options.clock = value;
+    } else if (flag == "--reset") {
+      options.reset = value;
+    } else if (flag == "--config-addr") {
+      options.configAddr = value;
+    } else if (flag == "--config-data") {
+      options.configData = value;
+    } else {
+      cerr << "ERROR: Unknown option " << flag << endl;
+      return false;
+    }
+  }
+
+  if ((options.json == "") || (options.top == "")) {
+    cerr << "ERROR: --json and --top are required" << endl;
+    return false;
+  }
+
+  if ((options.format != "csv") && (options.format != "binary")) {
+    cerr << "ERROR: Unknown output format " << options.format << endl;
+    return false;
+  }
+
+  if ((options.outputs.size() > 0) && (options.outFile == "")) {
+    cerr << "ERROR: --outputs requires --out" << endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Sorted by cycle
+static bool loadStimulus(const string& fileName, vector<Assignment>& stimulus) {
+  ifstream in(fileName);
+  if (!in) {
+    cerr << "ERROR: Could not open stimulus file " << fileName << endl;
+    return false;
+  }
+
+  string line;
+  while (getline(in, line)) {
+    if ((line.size() == 0) || (line[0] == '#')) {
+      continue;
+    }
+
+    stringstream ss(line);
+    Assignment assignment;
+    string value;
+    if (!(ss >> assignment.cycle >> assignment.signal >> value)) {
+      cerr << "ERROR: Malformed stimulus line: " << line << endl;
+      return false;
+    }
+    assignment.value = BitVector(value);
+    stimulus.push_back(assignment);
+  }
+
+  stable_sort(begin(stimulus), end(stimulus),
+              [](const Assignment& a, const Assignment& b) {
+                return a.cycle < b.cycle;
+              });
+
+  return true;
+}
+
+static void writeCSV(ostream& out,
+                     const vector<string>& names,
+                     const vector<vector<BitVector> >& rows) {
+  out << "cycle";
+  for (auto& name : names) {
+    out << "," << name;
+  }
+  out << endl;
+
+  for (int cycle = 0; cycle < (int) rows.size(); cycle++) {
+    out << cycle;
+    for (auto& bv : rows[cycle]) {
+      out << "," << bv;
+    }
+    out << endl;
+  }
+}
+
+static double millisecondsSince(const chrono::steady_clock::time_point start) {
+  auto now = chrono::steady_clock::now();
+  return chrono::duration<double, milli>(now - start).count();
+}
+
+int main(int argc, char** argv) {
+  // The players, recorders and checkers report why they failed to open
+  // through the log
+  setLogLevel(LOG_LEVEL_ERROR);
+
+  RunOptions options;
+  if (!parseOptions(argc, argv, options)) {
+    printUsage();
+    return 1;
+  }
+
+  bool binaryStimulus =
+    (options.stimulus != "") && isBinaryStimulus(options.stimulus);
+
+  vector<Assignment> stimulus;
+  if ((options.stimulus != "") && !binaryStimulus &&
+      !loadStimulus(options.stimulus, stimulus)) {
+    return 1;
+  }
+
+  // Load
+  auto start = chrono::steady_clock::now();
+
+  Context* c = newContext();
+  CoreIRLoadLibrary_rtlil(c);
+  CoreIRLoadLibrary_commonlib(c);
+
+  Module* top = nullptr;
+  if (!loadFromFile(c, options.json, &top)) {
+    cerr << "ERROR: Could not load " << options.json << endl;
+    deleteContext(c);
+    return 1;
+  }
+
+  top = c->getModule(options.top);
+  if ((top == nullptr) || !top->hasDef()) {
+    cerr << "ERROR: No definition for " << options.top << endl;
+    deleteContext(c);
+    return 1;
+  }
+
+  c->runPasses(options.passes);
+
+  double loadTime = millisecondsSince(start);
+
+  // Elaborate
+  start = chrono::steady_clock::now();
+
+  EventSimulator* sim = new EventSimulator(top);
+
+  double elaborateTime = millisecondsSince(start);
+
+  // Text stimulus is only parsed, so bad signal names and widths are
+  // caught here instead of asserting in the middle of the run
+  for (auto& assignment : stimulus) {
+    if (sim->findInputHandle(assignment.signal) == nullptr) {
+      cerr << "ERROR: Unknown stimulus signal " << assignment.signal << endl;
+      delete sim;
+      deleteContext(c);
+      return 1;
+    }
+
+    int width = bitWidth(*sim->getValueHandle(assignment.signal));
+    if (assignment.value.bitLength() != width) {
+      cerr << "ERROR: Stimulus value for " << assignment.signal << " is " <<
+        assignment.value.bitLength() << " bits wide, expected " << width << endl;
+      delete sim;
+      deleteContext(c);
+      return 1;
+    }
+  }
+
+  vector<string> signals = options.outputs;
+  signals.insert(end(signals), begin(options.observed), end(options.observed));
+  for (auto& name : signals) {
+    if (sim->findValueHandle(name) == nullptr) {
+      cerr << "ERROR: Unknown signal " << name << endl;
+      delete sim;
+      deleteContext(c);
+      return 1;
+    }
+  }
+
+  // Configure
+  start = chrono::steady_clock::now();
+
+  if (options.reset != "") {
+    sim->setValue(options.reset, BitVector(1, 0));
+    sim->setValue(options.reset, BitVector(1, 1));
+    sim->setValue(options.reset, BitVector(1, 0));
+  }
+
+  if (options.bitstream != "") {
+    auto configValues = loadBitStream(options.bitstream);
+    for (auto& config : configValues) {
+      sim->setValue(options.clock, BitVec(1, 0));
+      sim->setValues({{options.configAddr, BitVec(32, config.first)},
+            {options.configData, BitVec(32, config.second)}});
+      sim->setValue(options.clock, BitVec(1, 1));
+    }
+
+    sim->setValue(options.configAddr, BitVec(32, 0));
+  }
+
+  // Configuration is loaded before restricting evaluation, so every
+  // configuration register is set even if it does not reach the observed
+  // signals
+  if ((options.observed.size() > 0) && !sim->observe(options.observed)) {
+    delete sim;
+    deleteContext(c);
+    return 1;
+  }
+
+  double configureTime = millisecondsSince(start);
+
+  StimulusPlayer* player = nullptr;
+  if (binaryStimulus) {
+    player = new StimulusPlayer(*sim, options.stimulus);
+    if (!player->isOpen()) {
+      delete player;
+      delete sim;
+      deleteContext(c);
+      return 1;
+    }
+  }
+
+  // Binary output is streamed to the file in blocks while running, csv
+  // output is kept in memory and written at the end
+  OutputRecorder* recorder = nullptr;
+  bool recordRows = (options.outputs.size() > 0) && (options.format == "csv");
+  if ((options.outputs.size() > 0) && (options.format == "binary")) {
+    for (auto& name : options.outputs) {
+      if (bitWidth(*sim->getValueHandle(name)) > 64) {
+        cerr << "ERROR: " << name << " is wider than 64 bits, use csv" << endl;
+        delete player;
+        delete sim;
+        deleteContext(c);
+        return 1;
+      }
+    }
+
+    recorder = new OutputRecorder(*sim, options.outputs, options.outFile);
+    if (!recorder->isOpen()) {
+      delete recorder;
+      delete player;
+      delete sim;
+      deleteContext(c);
+      return 1;
+    }
+  }
+
+  TraceChecker* checker = nullptr;
+  if (options.expect != "") {
+    checker = new TraceChecker(*sim, options.expect);
+    if (!checker->isOpen()) {
+      delete checker;
+      delete recorder;
+      delete player;
+      delete sim;
+      deleteContext(c);
+      return 1;
+    }
+  }
+
+  // Run
+  start = chrono::steady_clock::now();
+
+  bool matched = true;
+
+  vector<vector<BitVector> > rows;
+  if (recordRows) {
+    rows.reserve(options.cycles);
+  }
+
+  int next = 0;
+  for (int cycle = 0; cycle < options.cycles; cycle++) {
+    sim->setValue(options.clock, BitVec(1, 0));
+
+    if (player != nullptr) {
+      if (cycle < player->getNumCycles()) {
+        player->applyCycle(cycle);
+      }
+    } else {
+      vector<pair<string, BitVec> > inputs;
+      while ((next < (int) stimulus.size()) && (stimulus[next].cycle <= cycle)) {
+        inputs.push_back({stimulus[next].signal, stimulus[next].value});
+        next++;
+      }
+      if (inputs.size() > 0) {
+        sim->setValues(inputs);
+      }
+    }
+
+    sim->setValue(options.clock, BitVec(1, 1));
+
+    if ((checker != nullptr) && !checker->check()) {
+      cerr << checker->report() << endl;
+      matched = false;
+      break;
+    }
+
+    if (recorder != nullptr) {
+      recorder->sample();
+    } else if (recordRows) {
+      rows.push_back({});
+      for (auto& name : options.outputs) {
+        rows.back().push_back(sim->getBitVec(name));
+      }
+    }
+  }
+
+  delete recorder;
+
+  double runTime = millisecondsSince(start);
+
+  if ((checker != nullptr) && matched) {
+    cout << "Matched " << checker->getCycle() << " cycles of " << options.expect << endl;
+  }
+  delete checker;
+
+  delete player;
+
+  if (recordRows) {
+    ofstream out(options.outFile, ios::trunc);
+    writeCSV(out, options.outputs, rows);
+  }
+
+  cout << "load      " << loadTime << " ms" << endl;
+  cout << "elaborate " << elaborateTime << " ms" << endl;
+  cout << "configure " << configureTime << " ms" << endl;
+  cout << "run       " << runTime << " ms (" << options.cycles << " cycles)" << endl;
+
+  delete sim;
+  deleteContext(c);
+
+  return matched ? 0 : 2;
+}